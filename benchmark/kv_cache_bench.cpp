@@ -0,0 +1,307 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+// KVCache单线程性能测试
+//   kv_cache_bench [-k key数] [-o 每阶段操作数] [-d 分布] [-v 平均value字节] [-m 最大value字节]
+//                  [-r 混合阶段读比例%] [-c 块级别] [-l 耗时采样间隔]
+// value长度分布：fixed 固定为-v；uniform [1, -m]均匀；exp 均值为-v的指数分布，不超过-m
+// 块级别：形如 64:100000,512:20000 (块大小:块数)，默认按key数和最大长度计算单一级别
+// 依次测试 put(append新key)、peek、get_size、put(overwrite)、put(append已有key)、
+// 混合读写、get、del，输出每阶段的ops/s及ns/op分位数，以及内存占用
+
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "common/kv_cache.h"
+#include "common/memory.h"
+
+using namespace pebble;
+
+struct BenchConfig {
+    BenchConfig() : key_num(100000), op_num(1000000), dist("exp"), mean_size(256),
+        max_size(4096), read_percent(80), sample_interval(8) {}
+    uint32_t key_num;
+    uint32_t op_num;
+    std::string dist;
+    uint32_t mean_size;
+    uint32_t max_size;
+    uint32_t read_percent;
+    std::string classes;
+    uint32_t sample_interval;
+};
+
+static int64_t NowNS() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static uint32_t NextRand(uint64_t* seed) {
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 7;
+    *seed ^= *seed << 17;
+    return static_cast<uint32_t>(*seed);
+}
+
+// splitmix64，为双射，生成的key互不相同
+static uint64_t MixKey(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+static int GetRSS() {
+    int vm_kb = 0;
+    int rss_kb = 0;
+    GetCurMemoryUsage(&vm_kb, &rss_kb);
+    return rss_kb;
+}
+
+static uint32_t RandomSize(uint64_t* seed, const BenchConfig& cfg) {
+    uint32_t size = cfg.mean_size;
+    if (cfg.dist == "uniform") {
+        size = NextRand(seed) % cfg.max_size + 1;
+    } else if (cfg.dist == "exp") {
+        double u = (NextRand(seed) + 1.0) / 4294967297.0;
+        size = static_cast<uint32_t>(-log(u) * cfg.mean_size) + 1;
+    }
+    return std::min(size, cfg.max_size);
+}
+
+static int32_t ParseClasses(const BenchConfig& cfg, std::vector<KVCache::BlockClass>* classes) {
+    if (cfg.classes.empty()) {
+        // 默认单一级别，块数按每个key最大长度的2倍预留
+        KVCache::BlockClass cls;
+        cls.block_size = 512;
+        cls.block_num = cfg.key_num * ((cfg.max_size + cls.block_size - 1) / cls.block_size + 1) * 2;
+        classes->push_back(cls);
+        return 0;
+    }
+
+    const char* pos = cfg.classes.c_str();
+    while (*pos != '\0') {
+        KVCache::BlockClass cls;
+        if (sscanf(pos, "%u:%u", &cls.block_size, &cls.block_num) != 2) {
+            return -1;
+        }
+        classes->push_back(cls);
+        pos = strchr(pos, ',');
+        if (NULL == pos) {
+            break;
+        }
+        pos++;
+    }
+    return classes->empty() ? -1 : 0;
+}
+
+static int64_t Percentile(const std::vector<int64_t>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    return sorted[static_cast<size_t>(p * (sorted.size() - 1))];
+}
+
+// 一个测试阶段：整体计时得到吞吐，每sample_interval次操作单独计时一次得到分位数
+class Phase {
+public:
+    Phase(const char* name, const BenchConfig& cfg)
+        : m_name(name), m_interval(cfg.sample_interval), m_count(0), m_op_num(0), m_begin(NowNS()) {}
+
+    bool Sample() {
+        return m_interval > 0 && (++m_count % m_interval) == 0;
+    }
+    void Record(int64_t ns) {
+        m_samples.push_back(ns);
+    }
+    void Done(uint64_t op_num) {
+        m_op_num = op_num;
+        int64_t elapse = NowNS() - m_begin;
+        std::sort(m_samples.begin(), m_samples.end());
+        printf("%-16s %10.0f ops/s  ns/op p50 %6ld p90 %6ld p99 %6ld p999 %7ld max %8ld\n", m_name,
+            elapse > 0 ? m_op_num * 1e9 / elapse : 0.0, Percentile(m_samples, 0.5),
+            Percentile(m_samples, 0.9), Percentile(m_samples, 0.99), Percentile(m_samples, 0.999),
+            m_samples.empty() ? 0 : m_samples.back());
+    }
+
+private:
+    const char*             m_name;
+    uint32_t                m_interval;
+    uint32_t                m_count;
+    uint64_t                m_op_num;
+    int64_t                 m_begin;
+    std::vector<int64_t>    m_samples;
+};
+
+// 对一次操作按需计时
+#define BENCH_OP(phase, expr) \
+    do { \
+        if ((phase).Sample()) { \
+            int64_t op_begin = NowNS(); \
+            expr; \
+            (phase).Record(NowNS() - op_begin); \
+        } else { \
+            expr; \
+        } \
+    } while (0)
+
+static void PrintMemory(KVCache* cache, int rss_begin) {
+    KVCache::CacheInfo info;
+    cache->GetCacheInfo(&info);
+    printf("memory: region %lu KB, rss +%d KB, keys %u, blocks used %u/%u, data %lu KB, "
+        "alloc %lu KB (%.1f%% used), max chain %u, max probe %u\n",
+        info.region_size / 1024, GetRSS() - rss_begin, info.key_num,
+        info.block_num - info.free_block_num, info.block_num, info.data_size / 1024,
+        info.alloc_size / 1024, info.alloc_size ? info.data_size * 100.0 / info.alloc_size : 0.0,
+        info.max_chain_len, info.max_probe_len);
+}
+
+int main(int argc, char* argv[]) {
+    BenchConfig cfg;
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "k:o:d:v:m:r:c:l:h")) != -1) {
+        switch (opt) {
+            case 'k': cfg.key_num = atoi(optarg); break;
+            case 'o': cfg.op_num = atoi(optarg); break;
+            case 'd': cfg.dist = optarg; break;
+            case 'v': cfg.mean_size = atoi(optarg); break;
+            case 'm': cfg.max_size = atoi(optarg); break;
+            case 'r': cfg.read_percent = atoi(optarg); break;
+            case 'c': cfg.classes = optarg; break;
+            case 'l': cfg.sample_interval = atoi(optarg); break;
+            default:
+                printf("usage: %s [-k key_num] [-o op_num] [-d fixed|uniform|exp] [-v mean_size]"
+                    " [-m max_size] [-r read_percent] [-c size:num,...] [-l sample_interval]\n",
+                    argv[0]);
+                return 0;
+        }
+    }
+    std::vector<KVCache::BlockClass> classes;
+    if (cfg.key_num == 0 || cfg.op_num == 0 || cfg.mean_size == 0 || cfg.max_size == 0
+        || ParseClasses(cfg, &classes) != 0) {
+        printf("invalid arguments\n");
+        return -1;
+    }
+
+    printf("keys %u, ops %u, value %s mean %u max %u, read %u%%, classes", cfg.key_num,
+        cfg.op_num, cfg.dist.c_str(), cfg.mean_size, cfg.max_size, cfg.read_percent);
+    for (size_t i = 0; i < classes.size(); i++) {
+        printf(" %u:%u", classes[i].block_size, classes[i].block_num);
+    }
+    printf("\n");
+
+    int rss_begin = GetRSS();
+    KVCache cache;
+    if (cache.Init(cfg.key_num * 2, &classes[0], static_cast<uint32_t>(classes.size())) != 0) {
+        printf("init failed\n");
+        return -1;
+    }
+
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+    std::vector<char> value(cfg.max_size, 'v');
+    std::vector<char> buff(cfg.max_size * 4);
+    std::vector<uint64_t> keys(cfg.key_num);
+    for (uint32_t i = 0; i < cfg.key_num; i++) {
+        keys[i] = MixKey(i);
+    }
+    std::random_shuffle(keys.begin(), keys.end());
+    uint32_t fail_num = 0;
+    int32_t ret = 0;
+
+    {
+        Phase phase("put(new)", cfg);
+        for (uint32_t i = 0; i < cfg.key_num; i++) {
+            BENCH_OP(phase, ret = cache.Put(keys[i], &value[0], RandomSize(&seed, cfg), false));
+            fail_num += (ret != 0);
+        }
+        phase.Done(cfg.key_num);
+    }
+    PrintMemory(&cache, rss_begin);
+    {
+        Phase phase("peek", cfg);
+        for (uint32_t i = 0; i < cfg.op_num; i++) {
+            uint64_t key = keys[NextRand(&seed) % cfg.key_num];
+            BENCH_OP(phase, cache.Peek(key, &buff[0], buff.size()));
+        }
+        phase.Done(cfg.op_num);
+    }
+    {
+        Phase phase("get_size", cfg);
+        for (uint32_t i = 0; i < cfg.op_num; i++) {
+            uint64_t key = keys[NextRand(&seed) % cfg.key_num];
+            BENCH_OP(phase, cache.GetSize(key));
+        }
+        phase.Done(cfg.op_num);
+    }
+    {
+        Phase phase("put(overwrite)", cfg);
+        for (uint32_t i = 0; i < cfg.op_num; i++) {
+            uint64_t key = keys[NextRand(&seed) % cfg.key_num];
+            BENCH_OP(phase, ret = cache.Put(key, &value[0], RandomSize(&seed, cfg), true));
+            fail_num += (ret != 0);
+        }
+        phase.Done(cfg.op_num);
+    }
+    {
+        // 追加写使数据增长，操作数限制为key数
+        Phase phase("put(append)", cfg);
+        for (uint32_t i = 0; i < cfg.key_num; i++) {
+            BENCH_OP(phase, ret = cache.Put(keys[i], &value[0], RandomSize(&seed, cfg), false));
+            fail_num += (ret != 0);
+        }
+        phase.Done(cfg.key_num);
+    }
+    PrintMemory(&cache, rss_begin);
+    {
+        Phase phase("mixed", cfg);
+        for (uint32_t i = 0; i < cfg.op_num; i++) {
+            uint64_t key = keys[NextRand(&seed) % cfg.key_num];
+            if (NextRand(&seed) % 100 < cfg.read_percent) {
+                BENCH_OP(phase, cache.Peek(key, &buff[0], buff.size()));
+            } else {
+                BENCH_OP(phase, ret = cache.Put(key, &value[0], RandomSize(&seed, cfg), true));
+                fail_num += (ret != 0);
+            }
+        }
+        phase.Done(cfg.op_num);
+    }
+    {
+        // 读出全部数据，key被删除
+        Phase phase("get", cfg);
+        for (uint32_t i = 0; i < cfg.key_num; i++) {
+            BENCH_OP(phase, cache.Get(keys[i], &buff[0], buff.size()));
+        }
+        phase.Done(cfg.key_num);
+    }
+    {
+        for (uint32_t i = 0; i < cfg.key_num; i++) {
+            fail_num += (cache.Put(keys[i], &value[0], RandomSize(&seed, cfg), false) != 0);
+        }
+        std::random_shuffle(keys.begin(), keys.end());
+        Phase phase("del", cfg);
+        for (uint32_t i = 0; i < cfg.key_num; i++) {
+            BENCH_OP(phase, cache.Del(keys[i]));
+        }
+        phase.Done(cfg.key_num);
+    }
+
+    printf("put failed %u\n", fail_num);
+    return 0;
+}
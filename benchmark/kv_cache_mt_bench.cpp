@@ -0,0 +1,223 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+// KVCache多线程吞吐测试
+//   kv_cache_mt_bench [-k key数] [-v value字节] [-r 读比例%] [-o 每线程操作数] [-s 分片数] [-t 最大线程数]
+// 线程数从1倍增至最大线程数(默认CPU核数)，分别测试：
+//   全局锁保护的单个KVCache
+//   ShardedKVCache
+// 输出总吞吐(Mops/s)及相对单线程的加速比
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "common/kv_cache.h"
+#include "common/mutex.h"
+#include "common/sharded_kv_cache.h"
+
+using namespace pebble;
+
+struct BenchConfig {
+    BenchConfig() : key_num(100000), value_size(128), read_percent(80), op_num(1000000),
+        shard_num(0), max_thread_num(0) {}
+    uint32_t key_num;
+    uint32_t value_size;
+    uint32_t read_percent;
+    uint32_t op_num;
+    uint32_t shard_num;
+    uint32_t max_thread_num;
+};
+
+static int64_t NowNS() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static uint32_t NextRand(uint64_t* seed) {
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 7;
+    *seed ^= *seed << 17;
+    return static_cast<uint32_t>(*seed);
+}
+
+// 全局锁保护的KVCache，作为对照
+class LockedKVCache {
+public:
+    int32_t Init(uint32_t max_frame_num, uint32_t block_num, uint32_t block_size) {
+        return m_cache.Init(max_frame_num, block_num, block_size);
+    }
+    int32_t Put(uint64_t key, const char* buff, uint32_t length, bool is_overwrite) {
+        AutoLocker locker(&m_lock);
+        return m_cache.Put(key, buff, length, is_overwrite);
+    }
+    int32_t Get(uint64_t key, char* buff, uint32_t length) {
+        AutoLocker locker(&m_lock);
+        return m_cache.Peek(key, buff, length);
+    }
+
+private:
+    Mutex   m_lock;
+    KVCache m_cache;
+};
+
+class ShardedCache {
+public:
+    explicit ShardedCache(uint32_t shard_num) : m_shard_num(shard_num) {}
+    int32_t Init(uint32_t max_frame_num, uint32_t block_num, uint32_t block_size) {
+        return m_cache.Init(m_shard_num, max_frame_num, block_num, block_size);
+    }
+    int32_t Put(uint64_t key, const char* buff, uint32_t length, bool is_overwrite) {
+        return m_cache.Put(key, buff, length, is_overwrite);
+    }
+    int32_t Get(uint64_t key, char* buff, uint32_t length) {
+        return m_cache.Peek(key, buff, length);
+    }
+
+private:
+    uint32_t       m_shard_num;
+    ShardedKVCache m_cache;
+};
+
+template <typename Cache>
+struct WorkerArg {
+    Cache*              cache;
+    const BenchConfig*  cfg;
+    uint64_t            seed;
+    int64_t             elapse_ns;
+};
+
+template <typename Cache>
+static void* WorkerMain(void* arg) {
+    WorkerArg<Cache>* worker = static_cast<WorkerArg<Cache>*>(arg);
+    const BenchConfig& cfg = *worker->cfg;
+    std::vector<char> value(cfg.value_size, 'v');
+    std::vector<char> buff(cfg.value_size);
+
+    int64_t begin = NowNS();
+    for (uint32_t i = 0; i < cfg.op_num; i++) {
+        uint64_t key = NextRand(&worker->seed) % cfg.key_num;
+        if (NextRand(&worker->seed) % 100 < cfg.read_percent) {
+            worker->cache->Get(key, &buff[0], cfg.value_size);
+        } else {
+            worker->cache->Put(key, &value[0], cfg.value_size, true);
+        }
+    }
+    worker->elapse_ns = NowNS() - begin;
+    return NULL;
+}
+
+template <typename Cache>
+static double RunOnce(Cache* cache, const BenchConfig& cfg, uint32_t thread_num) {
+    std::vector<pthread_t> threads(thread_num);
+    std::vector<WorkerArg<Cache> > args(thread_num);
+    for (uint32_t i = 0; i < thread_num; i++) {
+        args[i].cache = cache;
+        args[i].cfg = &cfg;
+        args[i].seed = 0x9E3779B97F4A7C15ULL * (i + 1);
+        args[i].elapse_ns = 0;
+    }
+
+    int64_t begin = NowNS();
+    for (uint32_t i = 0; i < thread_num; i++) {
+        pthread_create(&threads[i], NULL, WorkerMain<Cache>, &args[i]);
+    }
+    for (uint32_t i = 0; i < thread_num; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    int64_t elapse_ns = NowNS() - begin;
+
+    return static_cast<double>(cfg.op_num) * thread_num * 1000.0 / elapse_ns;
+}
+
+template <typename Cache>
+static void RunBench(const char* name, Cache* cache, const BenchConfig& cfg) {
+    // 每个key预留2倍空间，避免测试过程中因空间不足失败
+    const uint32_t kBlockSize = 64;
+    uint32_t block_num = (cfg.value_size + kBlockSize - 1) / kBlockSize * cfg.key_num * 2;
+    if (cache->Init(cfg.key_num * 2, block_num, kBlockSize) != 0) {
+        printf("%s init failed\n", name);
+        return;
+    }
+
+    // 预热：写入全部key
+    std::vector<char> value(cfg.value_size, 'v');
+    for (uint32_t key = 0; key < cfg.key_num; key++) {
+        cache->Put(key, &value[0], cfg.value_size, true);
+    }
+
+    printf("==== %s ====\n", name);
+    double base = 0.0;
+    for (uint32_t thread_num = 1; ; thread_num *= 2) {
+        if (thread_num > cfg.max_thread_num) {
+            thread_num = cfg.max_thread_num;
+        }
+        double mops = RunOnce(cache, cfg, thread_num);
+        if (thread_num == 1) {
+            base = mops;
+        }
+        printf("threads %3u: %8.2f Mops/s, speedup %5.2fx\n", thread_num, mops,
+            base > 0.0 ? mops / base : 0.0);
+        if (thread_num >= cfg.max_thread_num) {
+            break;
+        }
+    }
+    printf("\n");
+}
+
+int main(int argc, char* argv[]) {
+    BenchConfig cfg;
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "k:v:r:o:s:t:h")) != -1) {
+        switch (opt) {
+            case 'k': cfg.key_num = atoi(optarg); break;
+            case 'v': cfg.value_size = atoi(optarg); break;
+            case 'r': cfg.read_percent = atoi(optarg); break;
+            case 'o': cfg.op_num = atoi(optarg); break;
+            case 's': cfg.shard_num = atoi(optarg); break;
+            case 't': cfg.max_thread_num = atoi(optarg); break;
+            default:
+                printf("usage: %s [-k key_num] [-v value_size] [-r read_percent] [-o op_num_per_thread]"
+                    " [-s shard_num] [-t max_thread_num]\n", argv[0]);
+                return 0;
+        }
+    }
+    if (cfg.max_thread_num == 0) {
+        long cpu_num = sysconf(_SC_NPROCESSORS_ONLN);
+        cfg.max_thread_num = cpu_num > 0 ? static_cast<uint32_t>(cpu_num) : 1;
+    }
+    if (cfg.shard_num == 0) {
+        cfg.shard_num = cfg.max_thread_num * 4;
+    }
+    if (cfg.key_num == 0 || cfg.value_size == 0 || cfg.op_num == 0) {
+        printf("key_num, value_size and op_num must be > 0\n");
+        return -1;
+    }
+
+    printf("keys %u, value %u B, read %u%%, %u ops/thread, %u shards\n\n", cfg.key_num,
+        cfg.value_size, cfg.read_percent, cfg.op_num, cfg.shard_num);
+    {
+        LockedKVCache cache;
+        RunBench("KVCache + global Mutex", &cache, cfg);
+    }
+    {
+        ShardedCache cache(cfg.shard_num);
+        RunBench("ShardedKVCache", &cache, cfg);
+    }
+
+    return 0;
+}
@@ -0,0 +1,165 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+// 并行算法性能测试
+//   parallel_bench [-n 元素数] [-t 线程数] [-g grain] [-w 是否工作窃取]
+// 对比按元素AddTask+GetFinishedTaskID轮询、ParallelFor/ParallelReduce与单线程的耗时，
+// 以及ParallelSort与std::sort的耗时
+
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "common/parallel.h"
+#include "common/thread_pool.h"
+
+using namespace pebble;
+
+struct BenchConfig {
+    BenchConfig() : item_num(10000000), thread_num(4), grain(10000), work_stealing(true) {}
+    int64_t item_num;
+    int32_t thread_num;
+    int64_t grain;
+    bool work_stealing;
+};
+
+static BenchConfig g_cfg;
+static std::vector<double> g_values;
+
+static int64_t NowNS() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void Report(const char* name, int64_t cost_ns, double result) {
+    printf("%-32s %10.2f ms %8.2f ns/item  result %.6g\n", name, cost_ns / 1e6,
+        static_cast<double>(cost_ns) / g_cfg.item_num, result);
+}
+
+static void Update(int64_t i) {
+    double x = g_values[i];
+    g_values[i] = x * 0.5 + 1.0;
+}
+
+static double Value(int64_t i) {
+    return g_values[i];
+}
+
+static double Sum(double a, double b) {
+    return a + b;
+}
+
+// 业务中常见的手写方式：每个grain提交一个任务，轮询完成的任务ID
+static void UpdateRange(int64_t begin, int64_t end) {
+    for (int64_t i = begin; i < end; i++) {
+        Update(i);
+    }
+}
+
+static void BenchHandRolled(ThreadPool* pool) {
+    int64_t begin = NowNS();
+    int64_t task_num = 0;
+    for (int64_t i = 0; i < g_cfg.item_num; i += g_cfg.grain) {
+        cxx::function<void()> task = cxx::bind(UpdateRange, i,
+            std::min(i + g_cfg.grain, g_cfg.item_num));
+        pool->AddTask(task, task_num++);
+    }
+    int64_t task_id = 0;
+    while (task_num > 0) {
+        if (pool->GetFinishedTaskID(&task_id)) {
+            task_num--;
+        } else {
+            sched_yield();
+        }
+    }
+    Report("AddTask + GetFinishedTaskID", NowNS() - begin, g_values[0]);
+}
+
+static void BenchParallelFor(ThreadPool* pool, const char* name) {
+    int64_t begin = NowNS();
+    ParallelFor(pool, 0, g_cfg.item_num, g_cfg.grain, Update);
+    Report(name, NowNS() - begin, g_values[0]);
+}
+
+static void BenchParallelReduce(ThreadPool* pool, const char* name) {
+    int64_t begin = NowNS();
+    double sum = ParallelReduce(pool, 0, g_cfg.item_num, g_cfg.grain, 0.0, Value, Sum);
+    Report(name, NowNS() - begin, sum);
+}
+
+static void BenchSort(ThreadPool* pool) {
+    std::vector<uint32_t> data(g_cfg.item_num);
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+    for (size_t i = 0; i < data.size(); i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        data[i] = static_cast<uint32_t>(seed);
+    }
+    std::vector<uint32_t> copy = data;
+
+    int64_t begin = NowNS();
+    std::sort(copy.begin(), copy.end());
+    Report("std::sort", NowNS() - begin, copy[copy.size() / 2]);
+
+    begin = NowNS();
+    ParallelSort(pool, data.begin(), data.end());
+    Report("ParallelSort", NowNS() - begin, data[data.size() / 2]);
+    if (data != copy) {
+        printf("ParallelSort result mismatch\n");
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "n:t:g:w:h")) != -1) {
+        switch (opt) {
+            case 'n': g_cfg.item_num = strtoll(optarg, NULL, 10); break;
+            case 't': g_cfg.thread_num = atoi(optarg); break;
+            case 'g': g_cfg.grain = strtoll(optarg, NULL, 10); break;
+            case 'w': g_cfg.work_stealing = atoi(optarg) != 0; break;
+            default:
+                printf("usage: %s [-n item_num] [-t thread_num] [-g grain] [-w work_stealing]\n",
+                    argv[0]);
+                return 0;
+        }
+    }
+    if (g_cfg.item_num <= 0 || g_cfg.thread_num <= 0 || g_cfg.grain <= 0) {
+        printf("item_num, thread_num and grain must be > 0\n");
+        return -1;
+    }
+
+    ThreadPool pool;
+    ThreadPool::Options options;
+    options.thread_num = g_cfg.thread_num;
+    options.work_stealing = g_cfg.work_stealing;
+    if (pool.Init(options) != 0) {
+        printf("thread pool init failed\n");
+        return -1;
+    }
+
+    printf("items %ld, threads %d, grain %ld, work stealing %d\n", g_cfg.item_num,
+        g_cfg.thread_num, g_cfg.grain, g_cfg.work_stealing);
+    g_values.assign(g_cfg.item_num, 1.0);
+    BenchParallelFor(NULL, "sequential for");
+    BenchHandRolled(&pool);
+    BenchParallelFor(&pool, "ParallelFor");
+    BenchParallelReduce(NULL, "sequential reduce");
+    BenchParallelReduce(&pool, "ParallelReduce");
+    BenchSort(&pool);
+    return 0;
+}
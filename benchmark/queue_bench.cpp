@@ -0,0 +1,228 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+// 线程间单生产者单消费者传递性能测试
+//   queue_bench [-n 元素数] [-c 队列容量] [-b 批量大小]
+// 一个生产者线程向主线程传递1..n，对每种队列输出每个元素的平均传递耗时(ns)
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "common/blocking_queue.h"
+#include "common/mpmc_ring.h"
+#include "common/net_util.h"
+#include "common/spsc_ring.h"
+
+using namespace pebble;
+
+struct BenchConfig {
+    BenchConfig() : item_num(10000000), capacity(4096), batch(32) {}
+    uint64_t item_num;
+    uint32_t capacity;
+    uint32_t batch;
+};
+
+static BenchConfig g_cfg;
+
+static int64_t NowNS() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void Report(const char* name, int64_t cost_ns, uint64_t sum) {
+    uint64_t n = g_cfg.item_num;
+    bool ok = (sum == n * (n + 1) / 2);
+    printf("%-28s %8.1f ns/item %10.0f items/s %s\n", name,
+        static_cast<double>(cost_ns) / n, n * 1e9 / cost_ns, ok ? "" : "(CHECKSUM ERROR)");
+}
+
+// BlockingQueue
+static void* BlockingProducer(void* arg) {
+    BlockingQueue<uint64_t>* queue = static_cast<BlockingQueue<uint64_t>*>(arg);
+    for (uint64_t i = 1; i <= g_cfg.item_num; i++) {
+        queue->PushBack(i);
+    }
+    return NULL;
+}
+
+static void BenchBlockingQueue() {
+    BlockingQueue<uint64_t> queue;
+    pthread_t tid;
+    int64_t begin = NowNS();
+    pthread_create(&tid, NULL, BlockingProducer, &queue);
+    uint64_t sum = 0;
+    uint64_t value = 0;
+    for (uint64_t i = 0; i < g_cfg.item_num; i++) {
+        queue.PopFront(&value);
+        sum += value;
+    }
+    int64_t cost = NowNS() - begin;
+    pthread_join(tid, NULL);
+    Report("BlockingQueue", cost, sum);
+}
+
+// MpmcRing
+static void* MpmcProducer(void* arg) {
+    MpmcRing<uint64_t>* ring = static_cast<MpmcRing<uint64_t>*>(arg);
+    for (uint64_t i = 1; i <= g_cfg.item_num; i++) {
+        ring->PushBack(i);
+    }
+    return NULL;
+}
+
+static void BenchMpmcRing() {
+    MpmcRing<uint64_t> ring(g_cfg.capacity);
+    pthread_t tid;
+    int64_t begin = NowNS();
+    pthread_create(&tid, NULL, MpmcProducer, &ring);
+    uint64_t sum = 0;
+    uint64_t value = 0;
+    for (uint64_t i = 0; i < g_cfg.item_num; i++) {
+        ring.PopFront(&value);
+        sum += value;
+    }
+    int64_t cost = NowNS() - begin;
+    pthread_join(tid, NULL);
+    Report("MpmcRing", cost, sum);
+}
+
+// SpscRing，batch为1时逐个传递，满时让出CPU
+struct SpscArg {
+    SpscRing<uint64_t>* ring;
+    uint32_t batch;
+};
+
+static void* SpscProducer(void* arg) {
+    SpscArg* spsc = static_cast<SpscArg*>(arg);
+    std::vector<uint64_t> values(spsc->batch);
+    uint64_t next = 1;
+    while (next <= g_cfg.item_num) {
+        uint32_t num = 0;
+        while (num < spsc->batch && next + num <= g_cfg.item_num) {
+            values[num] = next + num;
+            num++;
+        }
+        uint32_t pushed = spsc->ring->PushBackBatch(&values[0], num);
+        if (0 == pushed) {
+            sched_yield();
+        }
+        next += pushed;
+    }
+    return NULL;
+}
+
+static void BenchSpscRing(uint32_t batch) {
+    SpscRing<uint64_t> ring(g_cfg.capacity);
+    SpscArg arg = { &ring, batch };
+    std::vector<uint64_t> values(batch);
+    pthread_t tid;
+    int64_t begin = NowNS();
+    pthread_create(&tid, NULL, SpscProducer, &arg);
+    uint64_t sum = 0;
+    uint64_t count = 0;
+    while (count < g_cfg.item_num) {
+        uint32_t num = ring.PopFrontBatch(&values[0], batch);
+        if (0 == num) {
+            sched_yield();
+            continue;
+        }
+        for (uint32_t i = 0; i < num; i++) {
+            sum += values[i];
+        }
+        count += num;
+    }
+    int64_t cost = NowNS() - begin;
+    pthread_join(tid, NULL);
+
+    char name[64];
+    snprintf(name, sizeof(name), "SpscRing(batch %u)", batch);
+    Report(name, cost, sum);
+}
+
+// SpscRing + eventfd，消费者空闲时在Epoll上等待
+static void BenchSpscRingEpoll() {
+    SpscRing<uint64_t> ring(g_cfg.capacity);
+    if (ring.EnableEventFd() < 0) {
+        printf("eventfd failed\n");
+        return;
+    }
+    Epoll epoll;
+    if (epoll.Init(16) != 0 || epoll.AddFd(ring.GetEventFd(), EPOLLIN, 0) != 0) {
+        printf("epoll init failed: %s\n", epoll.GetLastError());
+        return;
+    }
+
+    SpscArg arg = { &ring, 1 };
+    pthread_t tid;
+    int64_t begin = NowNS();
+    pthread_create(&tid, NULL, SpscProducer, &arg);
+    uint64_t sum = 0;
+    uint64_t count = 0;
+    uint64_t wait_num = 0;
+    uint64_t value = 0;
+    uint32_t events = 0;
+    uint64_t data = 0;
+    while (count < g_cfg.item_num) {
+        if (ring.TryPopFront(&value)) {
+            sum += value;
+            count++;
+            continue;
+        }
+        if (!ring.PrepareWait()) {
+            continue;
+        }
+        wait_num++;
+        if (epoll.Wait(100) > 0) {
+            while (epoll.GetEvent(&events, &data) == 0) {
+            }
+            ring.AckEvent();
+        }
+    }
+    int64_t cost = NowNS() - begin;
+    pthread_join(tid, NULL);
+    Report("SpscRing(eventfd+Epoll)", cost, sum);
+    printf("%-28s %8lu epoll waits\n", "", wait_num);
+}
+
+int main(int argc, char* argv[]) {
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "n:c:b:h")) != -1) {
+        switch (opt) {
+            case 'n': g_cfg.item_num = strtoull(optarg, NULL, 10); break;
+            case 'c': g_cfg.capacity = atoi(optarg); break;
+            case 'b': g_cfg.batch = atoi(optarg); break;
+            default:
+                printf("usage: %s [-n item_num] [-c capacity] [-b batch]\n", argv[0]);
+                return 0;
+        }
+    }
+    if (g_cfg.item_num == 0 || g_cfg.capacity == 0 || g_cfg.batch == 0) {
+        printf("item_num, capacity and batch must be > 0\n");
+        return -1;
+    }
+
+    printf("items %lu, capacity %u\n", g_cfg.item_num, g_cfg.capacity);
+    BenchBlockingQueue();
+    BenchMpmcRing();
+    BenchSpscRing(1);
+    BenchSpscRing(g_cfg.batch);
+    BenchSpscRingEpoll();
+    return 0;
+}
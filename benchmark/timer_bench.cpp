@@ -0,0 +1,239 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+// 定时器性能及超时精度测试
+//   timer_bench [-n 定时器数] [-t 最大超时ms] [-c 提前stop比例%] [-r restart次数比例%] [-s 精度ms]
+// 对每种定时器实现输出：
+//   start/stop/restart 每次操作耗时(ns)
+//   不同存活定时器数下，空转Update及有超时Update的耗时
+//   RSS增量，超时延迟分布(p50/p90/p99/max)
+
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "common/memory.h"
+#include "common/time_utility.h"
+#include "common/timer.h"
+#include "common/timer_service.h"
+
+using namespace pebble;
+
+struct BenchConfig {
+    BenchConfig() : timer_num(100000), max_timeout_ms(500), cancel_percent(50),
+        restart_percent(100), resolution_ms(10) {}
+    uint32_t timer_num;
+    uint32_t max_timeout_ms;
+    uint32_t cancel_percent;
+    uint32_t restart_percent;
+    uint32_t resolution_ms;
+};
+
+static int64_t NowNS() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static uint32_t NextRand(uint64_t* seed) {
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 7;
+    *seed ^= *seed << 17;
+    return static_cast<uint32_t>(*seed);
+}
+
+// 贴近业务的超时分布：大部分为少数几个固定超时(RPC/协程)，其余随机
+static uint32_t RandomTimeout(uint64_t* seed, uint32_t max_timeout_ms) {
+    static const uint32_t kCommonRatio[] = { 10, 20, 50, 100 }; // 占max_timeout_ms的百分比
+    uint32_t r = NextRand(seed) % 100;
+    uint32_t timeout = 0;
+    if (r < 80) {
+        timeout = max_timeout_ms * kCommonRatio[r % 4] / 100;
+    } else {
+        timeout = NextRand(seed) % max_timeout_ms;
+    }
+    return timeout > 0 ? timeout : 1;
+}
+
+struct LatencyRecorder {
+    LatencyRecorder() : drive_begin_us(0) {}
+
+    std::vector<int64_t> lateness_us;
+    std::vector<int64_t> deadline_us;   // 下标为定时器序号
+    int64_t drive_begin_us;             // 开始循环Update的时间，之前到期的按此时间计算延迟
+
+    int32_t OnTimeout(uint32_t index, int64_t /* timer_id */) {
+        int64_t expect = std::max(deadline_us[index], drive_begin_us);
+        lateness_us.push_back(TimeUtility::GetCurrentUS() - expect);
+        return kTIMER_BE_REMOVED;
+    }
+};
+
+static int64_t Percentile(const std::vector<int64_t>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t idx = static_cast<size_t>(p * (sorted.size() - 1));
+    return sorted[idx];
+}
+
+static int GetRSS() {
+    int vm_kb = 0;
+    int rss_kb = 0;
+    GetCurMemoryUsage(&vm_kb, &rss_kb);
+    return rss_kb;
+}
+
+static void RunBench(const char* name, Timer* timer, const BenchConfig& cfg) {
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+    LatencyRecorder recorder;
+    std::vector<int64_t> ids(cfg.timer_num, -1);
+    std::vector<uint32_t> timeouts(cfg.timer_num, 0);
+    recorder.deadline_us.resize(cfg.timer_num, 0);
+    recorder.lateness_us.reserve(cfg.timer_num);
+
+    for (uint32_t i = 0; i < cfg.timer_num; i++) {
+        timeouts[i] = RandomTimeout(&seed, cfg.max_timeout_ms);
+    }
+
+    int rss_begin = GetRSS();
+
+    // start
+    int64_t begin = NowNS();
+    for (uint32_t i = 0; i < cfg.timer_num; i++) {
+        recorder.deadline_us[i] = TimeUtility::GetCurrentUS() + timeouts[i] * 1000LL;
+        ids[i] = timer->StartTimer(timeouts[i],
+            cxx::bind(&LatencyRecorder::OnTimeout, &recorder, i, cxx::placeholders::_1));
+    }
+    int64_t start_ns = NowNS() - begin;
+    int rss_live = GetRSS();
+
+    // 空转Update：无超时时的固定开销
+    const int32_t kIdleLoops = 1000;
+    begin = NowNS();
+    for (int32_t i = 0; i < kIdleLoops; i++) {
+        timer->Update();
+    }
+    int64_t idle_update_ns = (NowNS() - begin) / kIdleLoops;
+
+    // restart风暴
+    uint32_t restart_num = static_cast<uint64_t>(cfg.timer_num) * cfg.restart_percent / 100;
+    begin = NowNS();
+    for (uint32_t i = 0; i < restart_num; i++) {
+        uint32_t index = NextRand(&seed) % cfg.timer_num;
+        if (timer->ReStartTimer(ids[index]) == 0) {
+            recorder.deadline_us[index] = TimeUtility::GetCurrentUS() + timeouts[index] * 1000LL;
+        }
+    }
+    int64_t restart_ns = NowNS() - begin;
+
+    // 超时前stop
+    uint32_t cancel_num = 0;
+    begin = NowNS();
+    for (uint32_t i = 0; i < cfg.timer_num; i++) {
+        if (NextRand(&seed) % 100 < cfg.cancel_percent && timer->StopTimer(ids[i]) == 0) {
+            cancel_num++;
+        }
+    }
+    int64_t stop_ns = NowNS() - begin;
+
+    // 驱动至全部超时，按存活定时器数量级统计Update耗时
+    const int32_t kBuckets = 8;
+    int64_t bucket_ns[kBuckets] = { 0 };
+    int64_t bucket_calls[kBuckets] = { 0 };
+    int64_t bucket_fired[kBuckets] = { 0 };
+    recorder.drive_begin_us = TimeUtility::GetCurrentUS();
+    while (timer->GetTimerNum() > 0) {
+        int64_t live = timer->GetTimerNum();
+        int32_t bucket = 0;
+        for (int64_t n = live; n >= 10 && bucket < kBuckets - 1; n /= 10) {
+            bucket++;
+        }
+        begin = NowNS();
+        int32_t fired = timer->Update();
+        bucket_ns[bucket] += NowNS() - begin;
+        bucket_calls[bucket]++;
+        bucket_fired[bucket] += fired;
+        usleep(100);
+    }
+
+    std::sort(recorder.lateness_us.begin(), recorder.lateness_us.end());
+
+    printf("==== %s ====\n", name);
+    printf("timers %u, cancelled %u, restarts %u, fired %lu\n",
+        cfg.timer_num, cancel_num, restart_num, recorder.lateness_us.size());
+    printf("(SequenceTimer counts in ms, lateness may be negative by < 1ms)\n");
+    printf("start    %8.1f ns/op\n", static_cast<double>(start_ns) / cfg.timer_num);
+    printf("restart  %8.1f ns/op\n", restart_num ? static_cast<double>(restart_ns) / restart_num : 0.0);
+    printf("stop     %8.1f ns/op\n", cancel_num ? static_cast<double>(stop_ns) / cancel_num : 0.0);
+    printf("idle update %ld ns with %u live timers\n", idle_update_ns, cfg.timer_num);
+    printf("rss +%d KB after start (%.1f B/timer)\n", rss_live - rss_begin,
+        (rss_live - rss_begin) * 1024.0 / cfg.timer_num);
+    printf("update cost by live timers:\n");
+    for (int32_t i = 0; i < kBuckets; i++) {
+        if (bucket_calls[i] == 0) {
+            continue;
+        }
+        printf("  live < 1e%d: %8ld calls, %10.1f ns/update, %8.1f ns/fired\n", i + 1,
+            bucket_calls[i], static_cast<double>(bucket_ns[i]) / bucket_calls[i],
+            bucket_fired[i] ? static_cast<double>(bucket_ns[i]) / bucket_fired[i] : 0.0);
+    }
+    const std::vector<int64_t>& lat = recorder.lateness_us;
+    printf("lateness us: p50 %ld, p90 %ld, p99 %ld, max %ld\n\n",
+        Percentile(lat, 0.5), Percentile(lat, 0.9), Percentile(lat, 0.99),
+        lat.empty() ? 0 : lat.back());
+}
+
+int main(int argc, char* argv[]) {
+    BenchConfig cfg;
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "n:t:c:r:s:h")) != -1) {
+        switch (opt) {
+            case 'n': cfg.timer_num = atoi(optarg); break;
+            case 't': cfg.max_timeout_ms = atoi(optarg); break;
+            case 'c': cfg.cancel_percent = atoi(optarg); break;
+            case 'r': cfg.restart_percent = atoi(optarg); break;
+            case 's': cfg.resolution_ms = atoi(optarg); break;
+            default:
+                printf("usage: %s [-n timer_num] [-t max_timeout_ms] [-c cancel_percent]"
+                    " [-r restart_percent] [-s resolution_ms]\n", argv[0]);
+                return 0;
+        }
+    }
+    if (cfg.timer_num == 0 || cfg.max_timeout_ms == 0) {
+        printf("timer_num and max_timeout_ms must be > 0\n");
+        return -1;
+    }
+
+    {
+        SequenceTimer timer;
+        RunBench("SequenceTimer", &timer, cfg);
+    }
+    {
+        SequenceTimer timer;
+        timer.SetResolution(cfg.resolution_ms);
+        char name[64];
+        snprintf(name, sizeof(name), "SequenceTimer(resolution %ums)", cfg.resolution_ms);
+        RunBench(name, &timer, cfg);
+    }
+    {
+        TimerService timer;
+        timer.RegisterThread();
+        RunBench("TimerService(local shard)", &timer, cfg);
+    }
+
+    return 0;
+}
@@ -11,13 +11,17 @@
  *
  */
 
+#include <dirent.h>
 #include <errno.h>
 #include <linux/limits.h>
+#include <sched.h>
+#include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <algorithm>
 
 #include "common/cpu.h"
 
@@ -116,5 +120,110 @@ float CalculateCurCpuUseage(long long cur_cpu_time_start, long long cur_cpu_time
     return (sysconf(_SC_NPROCESSORS_ONLN) * 100.0f *(cur_cpu_time_stop - cur_cpu_time_start)) / cpu_result;
 }
 
+int32_t ParseCpuList(const char* list, std::vector<int32_t>* cpus) {
+    cpus->clear();
+    const char* pos = list;
+    while (*pos != '\0' && *pos != '\n') {
+        char* end = NULL;
+        long first = strtol(pos, &end, 10);
+        if (end == pos || first < 0) {
+            return -1;
+        }
+        long last = first;
+        pos = end;
+        if (*pos == '-') {
+            ++pos;
+            last = strtol(pos, &end, 10);
+            if (end == pos || last < first) {
+                return -1;
+            }
+            pos = end;
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            cpus->push_back(static_cast<int32_t>(cpu));
+        }
+        if (*pos == ',') {
+            ++pos;
+        }
+    }
+    return 0;
+}
+
+int32_t GetAllowedCpus(std::vector<int32_t>* cpus) {
+    cpus->clear();
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+        return -1;
+    }
+    for (int32_t cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &set)) {
+            cpus->push_back(cpu);
+        }
+    }
+    return 0;
+}
+
+int32_t GetNumaNodes(std::vector<std::vector<int32_t> >* node_cpus) {
+    node_cpus->clear();
+    std::vector<int32_t> allowed;
+    if (GetAllowedCpus(&allowed) != 0) {
+        return -1;
+    }
+
+    // 节点目录名为nodeN，按N排序保证节点顺序稳定
+    std::vector<int32_t> nodes;
+    DIR* dir = opendir("/sys/devices/system/node");
+    if (dir != NULL) {
+        struct dirent* entry = NULL;
+        while ((entry = readdir(dir)) != NULL) {
+            char* end = NULL;
+            if (strncmp(entry->d_name, "node", 4) != 0) {
+                continue;
+            }
+            long node = strtol(entry->d_name + 4, &end, 10);
+            if (end != entry->d_name + 4 && *end == '\0') {
+                nodes.push_back(static_cast<int32_t>(node));
+            }
+        }
+        closedir(dir);
+    }
+    std::sort(nodes.begin(), nodes.end());
+
+    for (size_t i = 0; i < nodes.size(); i++) {
+        char file_name[64] = { 0 };
+        snprintf(file_name, sizeof(file_name), "/sys/devices/system/node/node%d/cpulist", nodes[i]);
+        FILE* file = fopen(file_name, "r");
+        if (!file) {
+            continue;
+        }
+        char line[4096] = { 0 };
+        char* ret = fgets(line, sizeof(line), file);
+        fclose(file);
+
+        std::vector<int32_t> cpus;
+        if (ret == NULL || ParseCpuList(line, &cpus) != 0) {
+            continue;
+        }
+        std::vector<int32_t> usable;
+        for (size_t j = 0; j < cpus.size(); j++) {
+            if (std::binary_search(allowed.begin(), allowed.end(), cpus[j])) {
+                usable.push_back(cpus[j]);
+            }
+        }
+        if (!usable.empty()) {
+            node_cpus->push_back(usable);
+        }
+    }
+
+    if (node_cpus->empty()) {
+        node_cpus->push_back(allowed);
+    }
+    return 0;
+}
+
+int32_t GetCurrentCpu() {
+    return sched_getcpu();
+}
 
 } // namespace pebble
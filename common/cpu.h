@@ -15,6 +15,8 @@
 #ifndef _PEBBLE_COMMON_CPU_H_
 #define _PEBBLE_COMMON_CPU_H_
 
+#include <stdint.h>
+#include <vector>
 
 namespace pebble {
 
@@ -32,6 +34,23 @@ long long GetTotalCpuTime();
 float CalculateCurCpuUseage(long long cur_cpu_time_start, long long cur_cpu_time_stop,
     long long total_cpu_time_start, long long total_cpu_time_stop);
 
+/// @brief 解析CPU列表，格式同/sys下的cpulist，如"0-3,8,10-11"
+/// @return 0 成功，-1 格式错误
+int32_t ParseCpuList(const char* list, std::vector<int32_t>* cpus);
+
+/// @brief 获取当前进程允许运行的CPU(sched_getaffinity)
+/// @return 0 成功，-1 失败
+int32_t GetAllowedCpus(std::vector<int32_t>* cpus);
+
+/// @brief 获取NUMA拓扑，node_cpus[i]为第i个节点上当前进程允许运行的CPU
+/// @note 没有允许CPU的节点被忽略，系统不支持NUMA时视为包含所有允许CPU的一个节点
+/// @return 0 成功，-1 失败
+int32_t GetNumaNodes(std::vector<std::vector<int32_t> >* node_cpus);
+
+/// @brief 获取当前线程正在运行的CPU
+/// @return >=0 CPU编号，-1 失败
+int32_t GetCurrentCpu();
+
 } // namespace pebble
 
 #endif // _PEBBLE_COMMON_CPU_H_
\ No newline at end of file
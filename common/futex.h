@@ -0,0 +1,53 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#ifndef _PEBBLE_COMMON_FUTEX_H_
+#define _PEBBLE_COMMON_FUTEX_H_
+
+#include <linux/futex.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace pebble {
+
+
+/// @brief 当*addr等于value时睡眠，直到被FutexWake唤醒或超时
+/// @param timeout_ms 超时时间(ms)，<0表示一直等待
+/// @return 0 被唤醒(可能为虚假唤醒)，-1 *addr不等于value、超时或被信号中断
+/// @note 仅用于同一进程内的线程间同步
+inline int FutexWait(int32_t* addr, int32_t value, int timeout_ms = -1)
+{
+    struct timespec ts;
+    struct timespec* timeout = NULL;
+    if (timeout_ms >= 0)
+    {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+        timeout = &ts;
+    }
+    return static_cast<int>(syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, value, timeout, NULL, 0));
+}
+
+/// @brief 唤醒在addr上等待的最多num个线程
+/// @return 唤醒的线程数
+inline int FutexWake(int32_t* addr, int32_t num)
+{
+    return static_cast<int>(syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, num, NULL, NULL, 0));
+}
+
+} // namespace pebble
+
+#endif // _PEBBLE_COMMON_FUTEX_H_
@@ -0,0 +1,433 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#ifndef _PEBBLE_COMMON_FUTURE_H_
+#define _PEBBLE_COMMON_FUTURE_H_
+
+#include <stdint.h>
+#include <vector>
+
+#include "common/condition_variable.h"
+#include "common/mutex.h"
+#include "common/platform.h"
+#include "common/time_utility.h"
+
+namespace pebble {
+
+
+/// @brief 任务执行器，用于指定Future后续任务的执行位置，如ThreadPool
+class Executor
+{
+public:
+    virtual ~Executor() {}
+
+    /// @brief 异步执行fun
+    /// @return 0 成功，其他 失败
+    virtual int32_t Execute(const cxx::function<void()>& fun) = 0;
+};
+
+template <typename T> class Future;
+template <typename T> class Promise;
+
+/// @brief Future<void>的值类型
+struct FutureVoid {};
+
+template <typename T>
+struct FutureValue
+{
+    typedef T Type;
+};
+
+template <>
+struct FutureValue<void>
+{
+    typedef FutureVoid Type;
+};
+
+/// @brief Then的后续任务类型，以前一个任务的结果为参数
+template <typename R, typename T>
+struct FutureFunction
+{
+    typedef cxx::function<R(const T&)> Type;
+};
+
+template <typename R>
+struct FutureFunction<R, void>
+{
+    typedef cxx::function<R()> Type;
+};
+
+/// @brief 用future的结果调用fun
+template <typename R, typename T>
+struct FutureApply
+{
+    static R Apply(const typename FutureFunction<R, T>::Type& fun, const Future<T>& future)
+    {
+        return fun(future.Get());
+    }
+};
+
+template <typename R>
+struct FutureApply<R, void>
+{
+    static R Apply(const typename FutureFunction<R, void>::Type& fun, const Future<void>& future)
+    {
+        return fun();
+    }
+};
+
+/// @brief 执行fun并将结果写入promise
+template <typename R>
+struct FutureRun
+{
+    static void Run(const cxx::function<R()>& fun, Promise<R> promise)
+    {
+        promise.SetValue(fun());
+    }
+};
+
+template <>
+struct FutureRun<void>
+{
+    static void Run(const cxx::function<void()>& fun, Promise<void> promise);
+};
+
+/// @brief Future和Promise共享的状态，引用计数管理
+template <typename T>
+class FutureState
+{
+public:
+    typedef typename FutureValue<T>::Type ValueType;
+
+    FutureState() : m_ref_num(1), m_promise_num(0), m_ready(false), m_broken(false), m_value() {}
+
+    void AddRef()
+    {
+        __atomic_add_fetch(&m_ref_num, 1, __ATOMIC_RELAXED);
+    }
+
+    void Release()
+    {
+        if (__atomic_sub_fetch(&m_ref_num, 1, __ATOMIC_ACQ_REL) == 0)
+        {
+            delete this;
+        }
+    }
+
+    void AddPromise()
+    {
+        __atomic_add_fetch(&m_promise_num, 1, __ATOMIC_RELAXED);
+    }
+
+    /// @brief 最后一个Promise析构时仍未设置结果，则Future失效
+    void ReleasePromise()
+    {
+        if (__atomic_sub_fetch(&m_promise_num, 1, __ATOMIC_ACQ_REL) == 0)
+        {
+            Complete(NULL);
+        }
+    }
+
+    /// @brief 设置结果，唤醒等待者并执行后续任务
+    /// @param value 结果，为NULL时标记为失效，后续任务不再执行
+    /// @return 0 成功，-1 已经设置过
+    int32_t Complete(const ValueType* value)
+    {
+        std::vector<Callback> callbacks;
+        {
+            AutoLocker locker(&m_mutex);
+            if (m_ready)
+            {
+                return -1;
+            }
+            if (value != NULL)
+            {
+                m_value = *value;
+            }
+            else
+            {
+                m_broken = true;
+            }
+            callbacks.swap(m_callbacks);
+            __atomic_store_n(&m_ready, true, __ATOMIC_RELEASE);
+            m_cond.Broadcast();
+        }
+
+        // 失效时直接丢弃后续任务，其持有的Promise析构后，后续的Future同样失效
+        if (value != NULL)
+        {
+            for (size_t i = 0; i < callbacks.size(); ++i)
+            {
+                RunCallback(callbacks[i]);
+            }
+        }
+        return 0;
+    }
+
+    /// @brief 添加后续任务，已完成时立即执行
+    void AddCallback(const cxx::function<void()>& fun, Executor* executor)
+    {
+        Callback callback;
+        callback.fun = fun;
+        callback.executor = executor;
+        {
+            AutoLocker locker(&m_mutex);
+            if (!m_ready)
+            {
+                m_callbacks.push_back(callback);
+                return;
+            }
+        }
+        if (!m_broken)
+        {
+            RunCallback(callback);
+        }
+    }
+
+    bool IsReady() const
+    {
+        return __atomic_load_n(&m_ready, __ATOMIC_ACQUIRE);
+    }
+
+    bool IsBroken() const
+    {
+        return IsReady() && m_broken;
+    }
+
+    void Wait()
+    {
+        if (IsReady())
+        {
+            return;
+        }
+        AutoLocker locker(&m_mutex);
+        while (!m_ready)
+        {
+            m_cond.Wait(&m_mutex);
+        }
+    }
+
+    bool WaitFor(int32_t timeout_ms)
+    {
+        if (IsReady())
+        {
+            return true;
+        }
+        int64_t deadline = TimeUtility::GetCurrentMS() + timeout_ms;
+        AutoLocker locker(&m_mutex);
+        while (!m_ready)
+        {
+            int64_t remain = deadline - TimeUtility::GetCurrentMS();
+            if (remain <= 0)
+            {
+                return false;
+            }
+            m_cond.TimedWait(&m_mutex, static_cast<int>(remain));
+        }
+        return true;
+    }
+
+    const ValueType& Value() const
+    {
+        return m_value;
+    }
+
+private:
+    struct Callback
+    {
+        cxx::function<void()> fun;
+        Executor* executor;
+    };
+
+    // 指定的执行器失败时(如线程池已停止)，在当前线程执行
+    static void RunCallback(const Callback& callback)
+    {
+        if (callback.executor != NULL && callback.executor->Execute(callback.fun) == 0)
+        {
+            return;
+        }
+        callback.fun();
+    }
+
+    int32_t m_ref_num;
+    int32_t m_promise_num;
+    bool m_ready;
+    bool m_broken;
+    ValueType m_value;
+    Mutex m_mutex;
+    ConditionVariable m_cond;
+    std::vector<Callback> m_callbacks;
+};
+
+/// @brief 异步结果的读取端，可复制，所有副本共享同一结果
+///   Wait/WaitFor等待结果，Get获取结果，Then在结果就绪后执行后续任务并返回其Future
+/// @note 对应的Promise全部析构而未设置结果时(如任务被丢弃)，Future失效：
+///   Wait返回，IsBroken()为true，Get返回默认值，后续任务不执行且其Future同样失效
+template <typename T>
+class Future
+{
+public:
+    typedef typename FutureValue<T>::Type ValueType;
+
+    Future() : m_state(NULL) {}
+
+    Future(const Future& other) : m_state(other.m_state)
+    {
+        if (m_state != NULL)
+        {
+            m_state->AddRef();
+        }
+    }
+
+    Future& operator=(const Future& other)
+    {
+        if (other.m_state != NULL)
+        {
+            other.m_state->AddRef();
+        }
+        if (m_state != NULL)
+        {
+            m_state->Release();
+        }
+        m_state = other.m_state;
+        return *this;
+    }
+
+    ~Future()
+    {
+        if (m_state != NULL)
+        {
+            m_state->Release();
+        }
+    }
+
+    /// @brief 是否关联了Promise，默认构造的Future无效，其他接口都不能调用
+    bool Valid() const
+    {
+        return m_state != NULL;
+    }
+
+    bool IsReady() const
+    {
+        return m_state->IsReady();
+    }
+
+    bool IsBroken() const
+    {
+        return m_state->IsBroken();
+    }
+
+    /// @brief 等待结果就绪
+    void Wait() const
+    {
+        m_state->Wait();
+    }
+
+    /// @brief 等待结果就绪
+    /// @return true 已就绪，false 超时
+    bool WaitFor(int32_t timeout_ms) const
+    {
+        return m_state->WaitFor(timeout_ms);
+    }
+
+    /// @brief 等待并获取结果
+    const ValueType& Get() const
+    {
+        m_state->Wait();
+        return m_state->Value();
+    }
+
+    /// @brief 结果就绪后以结果为参数执行fun，返回fun结果的Future
+    /// @param fun 后续任务，T为void时无参数
+    /// @param executor 执行后续任务的执行器，为NULL时在设置结果的线程执行，
+    ///   调用Then时已就绪则在当前线程执行
+    template <typename R>
+    Future<R> Then(const typename FutureFunction<R, T>::Type& fun, Executor* executor = NULL) const
+    {
+        Promise<R> promise;
+        cxx::function<R()> apply = cxx::bind(&FutureApply<R, T>::Apply, fun, *this);
+        m_state->AddCallback(cxx::bind(&FutureRun<R>::Run, apply, promise), executor);
+        return promise.GetFuture();
+    }
+
+private:
+    friend class Promise<T>;
+
+    explicit Future(FutureState<T>* state) : m_state(state)
+    {
+        m_state->AddRef();
+    }
+
+    FutureState<T>* m_state;
+};
+
+/// @brief 异步结果的写入端，可复制，结果只能设置一次
+template <typename T>
+class Promise
+{
+public:
+    typedef typename FutureValue<T>::Type ValueType;
+
+    Promise() : m_state(new FutureState<T>)
+    {
+        m_state->AddPromise();
+    }
+
+    Promise(const Promise& other) : m_state(other.m_state)
+    {
+        m_state->AddRef();
+        m_state->AddPromise();
+    }
+
+    Promise& operator=(const Promise& other)
+    {
+        other.m_state->AddRef();
+        other.m_state->AddPromise();
+        m_state->ReleasePromise();
+        m_state->Release();
+        m_state = other.m_state;
+        return *this;
+    }
+
+    ~Promise()
+    {
+        m_state->ReleasePromise();
+        m_state->Release();
+    }
+
+    Future<T> GetFuture() const
+    {
+        return Future<T>(m_state);
+    }
+
+    /// @brief 设置结果，T为void时传入FutureVoid()
+    /// @return 0 成功，-1 已经设置过
+    int32_t SetValue(const ValueType& value)
+    {
+        return m_state->Complete(&value);
+    }
+
+private:
+    FutureState<T>* m_state;
+};
+
+inline void FutureRun<void>::Run(const cxx::function<void()>& fun, Promise<void> promise)
+{
+    fun();
+    promise.SetValue(FutureVoid());
+}
+
+} // namespace pebble
+
+#endif // _PEBBLE_COMMON_FUTURE_H_
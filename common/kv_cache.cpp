@@ -12,257 +12,1657 @@
  */
 
 
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
 #include <algorithm>
+#include <string>
+#include <vector>
 
 #include "kv_cache.h"
 #include "log.h"
+#include "time_utility.h"
+#include "timer.h"
 
 namespace pebble {
 
 
-static const uint64_t __stl_prime_list[28] = {
-	53ul,         97ul,         193ul,       389ul,       769ul,
-	1543ul,       3079ul,       6151ul,      12289ul,     24593ul,
-	49157ul,      98317ul,      196613ul,    393241ul,    786433ul,
-	1572869ul,    3145739ul,    6291469ul,   12582917ul,  25165843ul,
-	50331653ul,   100663319ul,  201326611ul, 402653189ul, 805306457ul,
-	1610612741ul, 3221225473ul, 4294967291ul
+static const uint64_t kCACHE_MAGIC = 0x4b56434143484531ULL; // "KVCACHE1"
+static const uint32_t kCACHE_VERSION = 4;
+// 批量操作预取槽位的距离，块信息在一半距离时预取
+static const uint32_t kPREFETCH_DISTANCE = 8;
+
+// 快照文件格式：SnapshotHeader，每个key一个SnapshotRecord后跟数据，最后是SnapshotTail
+static const uint64_t kSNAPSHOT_MAGIC = 0x4b56534e41503031ULL; // "KVSNAP01"
+static const uint32_t kSNAPSHOT_VERSION = 1;
+// 每次writev的最大数据段数
+static const uint32_t kSNAPSHOT_IOV_NUM = 1024;
+
+struct SnapshotHeader
+{
+    uint64_t _magic;
+    uint32_t _version;
+    uint32_t _reserved;
+};
+
+struct SnapshotRecord
+{
+    uint64_t _key;
+    int64_t  _expire_time;
+    uint32_t _data_size;
+    uint32_t _reserved;
+};
+
+struct SnapshotTail
+{
+    uint64_t _magic;
+    uint64_t _key_num;
+    uint64_t _data_size;
+};
+
+/// @brief 写入全部数据段，处理部分写
+static int32_t WriteFull(int fd, struct iovec* iov, uint32_t iov_num)
+{
+    while (iov_num > 0)
+    {
+        ssize_t ret = writev(fd, iov, static_cast<int>(iov_num));
+        if (ret < 0)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            return -1;
+        }
+
+        size_t written = static_cast<size_t>(ret);
+        while (iov_num > 0 && written >= iov->iov_len)
+        {
+            written -= iov->iov_len;
+            iov++;
+            iov_num--;
+        }
+        if (iov_num > 0)
+        {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + written;
+            iov->iov_len -= written;
+        }
+    }
+    return 0;
+}
+
+/// @brief 快照的流式写入，记录头和块数据攒满一批后一次writev
+class SnapshotWriter
+{
+public:
+    explicit SnapshotWriter(int fd)
+        : m_fd(fd), m_iov_num(0), m_record_num(0), m_failed(false), m_errno(0) {}
+
+    void AddRecord(const SnapshotRecord& record)
+    {
+        // 记录头与数据段一起攒批，需保证两者都有空间
+        if (m_record_num >= kSNAPSHOT_IOV_NUM || m_iov_num >= kSNAPSHOT_IOV_NUM)
+        {
+            Flush();
+        }
+        m_records[m_record_num] = record;
+        Add(m_records + m_record_num, sizeof(record));
+        m_record_num++;
+    }
+
+    void Add(const void* data, size_t length)
+    {
+        if (0 == length)
+        {
+            return;
+        }
+        if (m_iov_num >= kSNAPSHOT_IOV_NUM)
+        {
+            Flush();
+        }
+        m_iov[m_iov_num].iov_base = const_cast<void*>(data);
+        m_iov[m_iov_num].iov_len = length;
+        m_iov_num++;
+    }
+
+    /// @return 0 成功，<0 写入失败
+    int32_t Flush()
+    {
+        if (!m_failed && m_iov_num > 0 && WriteFull(m_fd, m_iov, m_iov_num) != 0)
+        {
+            m_failed = true;
+            m_errno = errno;
+        }
+        m_iov_num = 0;
+        m_record_num = 0;
+        return m_failed ? -1 : 0;
+    }
+
+    /// @brief 第一次写入失败时的errno
+    int GetErrno() const { return m_errno; }
+
+private:
+    int             m_fd;
+    struct iovec    m_iov[kSNAPSHOT_IOV_NUM];
+    uint32_t        m_iov_num;
+    SnapshotRecord  m_records[kSNAPSHOT_IOV_NUM];
+    uint32_t        m_record_num;
+    bool            m_failed;
+    int             m_errno;
 };
 
-inline uint64_t __stl_next_prime(uint64_t __n) {
-	const uint64_t* __first = __stl_prime_list;
-	const uint64_t* __last = __stl_prime_list + 28;
-	const uint64_t* pos = std::lower_bound(__first, __last, __n);
-	return pos == __last ? *(__last - 1) : *pos;
+static size_t AlignCacheLine(size_t size)
+{
+    return (size + PEBBLE_CACHELINE_SIZE - 1) / PEBBLE_CACHELINE_SIZE * PEBBLE_CACHELINE_SIZE;
+}
+
+static bool CompareBlockSize(const KVCache::BlockClass& lhs, const KVCache::BlockClass& rhs)
+{
+    return lhs.block_size < rhs.block_size;
+}
+
+static int64_t NowNS()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
 }
 
+/// @brief 按采样间隔记录一次操作的耗时
+class KVCache::OpSampler
+{
+public:
+    OpSampler(KVCache* cache, OpType op) : m_cache(cache), m_op(op), m_begin(0)
+    {
+        if (0 != cache->m_sample_interval && ++cache->m_sample_count >= cache->m_sample_interval)
+        {
+            cache->m_sample_count = 0;
+            m_begin = NowNS();
+        }
+    }
+
+    ~OpSampler()
+    {
+        if (0 == m_begin)
+        {
+            return;
+        }
+        uint64_t cost = static_cast<uint64_t>(NowNS() - m_begin);
+        uint32_t bucket = (cost > 1 ? 63 - __builtin_clzll(cost) : 0);
+        bucket = std::min(bucket, kLATENCY_BUCKET_NUM - 1);
+        m_cache->m_stats.latency_hist[m_op][bucket]++;
+    }
+
+private:
+    KVCache*    m_cache;
+    OpType      m_op;
+    int64_t     m_begin;
+};
+
+void KVCache::Stats::Add(const Stats& other)
+{
+    hit_num += other.hit_num;
+    miss_num += other.miss_num;
+    evict_num += other.evict_num;
+    expire_num += other.expire_num;
+    put_num += other.put_num;
+    put_fail_num += other.put_fail_num;
+    for (uint32_t op = 0; op < kOP_NUM; ++op)
+    {
+        for (uint32_t idx = 0; idx < kLATENCY_BUCKET_NUM; ++idx)
+        {
+            latency_hist[op][idx] += other.latency_hist[op][idx];
+        }
+    }
+}
 
 KVCache::KVCache()
-    :   m_block_num(15000), m_block_size(512), m_free_block_size(0),
-        m_block_infos(NULL), m_block_mem(NULL)
+    :   m_block_num(kDEFAULT_BLOCK_NUM), m_block_size(kDEFAULT_BLOCK_SIZE), m_meta(NULL),
+        m_block_infos(NULL), m_block_mem(NULL),
+        m_slots(NULL), m_slot_mask(0), m_slot_shift(64),
+        m_region(NULL), m_region_size(0), m_is_mmap(false),
+        m_evict_policy(kEVICT_NONE), m_clock_hand(0), m_expire_cursor(0),
+        m_expire_timer(NULL), m_expire_timer_id(-1),
+        m_sample_interval(0), m_sample_count(0)
 {
 }
 
 KVCache::~KVCache()
 {
-    if (NULL != m_block_infos)
+    if (NULL != m_expire_timer)
     {
-        delete [] m_block_infos;
-        m_block_infos = NULL;
+        m_expire_timer->StopTimer(m_expire_timer_id);
+        m_expire_timer = NULL;
     }
-    if (NULL != m_block_mem)
+    Release();
+}
+
+void KVCache::Release()
+{
+    if (NULL != m_region)
     {
-        delete [] m_block_mem;
-        m_block_mem = NULL;
+        if (m_is_mmap)
+        {
+            munmap(m_region, m_region_size);
+        }
+        else
+        {
+            delete [] m_region;
+        }
     }
-    m_caches.clear();
+    m_region = NULL;
+    m_region_size = 0;
+    m_is_mmap = false;
+    m_meta = NULL;
+    m_block_infos = NULL;
+    m_block_mem = NULL;
+    m_slots = NULL;
+    m_clock_hand = 0;
+    m_expire_cursor = 0;
 }
 
-int32_t KVCache::Init(uint32_t max_frame_num, uint32_t block_num, uint32_t block_size)
+int32_t KVCache::SetupMeta(uint32_t max_frame_num, const BlockClass* classes, uint32_t class_num,
+    CacheMeta* meta)
 {
-    size_t hash_size = __stl_next_prime(static_cast<size_t>(max_frame_num));
-    m_caches.rehash(hash_size); // 访问非常频繁，稀疏桶，用空间换时间
+    if (NULL == classes || 0 == class_num || class_num > kMAX_BLOCK_CLASS_NUM)
+    {
+        return -1;
+    }
+    std::vector<BlockClass> sorted(classes, classes + class_num);
+    std::sort(sorted.begin(), sorted.end(), CompareBlockSize);
 
-    m_block_num = (block_num > 0 ? block_num : m_block_num);
-    m_block_size = (block_size > 0 ? block_size : m_block_size);
+    meta->_magic = kCACHE_MAGIC;
+    meta->_version = kCACHE_VERSION;
+    meta->_class_num = class_num;
 
-    m_block_infos = new CacheBlockInfo[block_num];
-    m_block_mem = new char[m_block_num * m_block_size];
+    uint64_t block_num = 0;
+    uint64_t mem_offset = 0;
+    for (uint32_t idx = 0; idx < kMAX_BLOCK_CLASS_NUM; ++idx)
+    {
+        BlockClassMeta& cls = meta->_classes[idx];
+        cls._block_size = (idx < class_num ? sorted[idx].block_size : 0);
+        cls._block_num = (idx < class_num ? sorted[idx].block_num : 0);
+        cls._first_block = static_cast<uint32_t>(block_num);
+        cls._free_block_head = CacheHeadInfo();
+        cls._key_num = 0;
+        cls._data_size = 0;
+        cls._mem_offset = mem_offset;
+        if (idx >= class_num)
+        {
+            continue;
+        }
+        if (0 == cls._block_size || 0 == cls._block_num
+            || (idx > 0 && cls._block_size == meta->_classes[idx - 1]._block_size))
+        {
+            return -1;
+        }
+        block_num += cls._block_num;
+        mem_offset += AlignCacheLine(static_cast<size_t>(cls._block_num) * cls._block_size);
+    }
+    // 块下标UINT32_MAX用作链表结束标记
+    if (block_num >= UINT32_MAX)
+    {
+        return -1;
+    }
+    meta->_block_num = static_cast<uint32_t>(block_num);
 
-    // 初始化block infos
-    for (uint32_t idx = 0 ; idx < m_block_num ; ++idx)
+    // 每个key至少占用一个block，key数不会超过block数
+    meta->_max_key_num = (max_frame_num > 0 ?
+        std::min(max_frame_num, meta->_block_num) : meta->_block_num);
+    // 装载率不超过3/4，槽位数取2的幂
+    uint64_t slot_num = 16;
+    while (slot_num * 3 < static_cast<uint64_t>(meta->_max_key_num) * 4)
     {
-        m_block_infos[idx]._write_pos = 0;
-        m_block_infos[idx]._read_pos = 0;
-        m_block_infos[idx]._next_block = idx + 1;
+        slot_num <<= 1;
     }
-    m_block_infos[m_block_num - 1]._next_block = UINT32_MAX;
+    meta->_slot_num = static_cast<uint32_t>(slot_num);
+    meta->_key_num = 0;
 
-    m_free_block_head._first_block = 0;
-    m_free_block_head._last_block = m_block_num - 1;
-    m_free_block_size = m_block_num;
+    size_t slot_offset = 0;
+    size_t info_offset = 0;
+    size_t block_mem_offset = 0;
+    meta->_region_size = CalcLayout(*meta, &slot_offset, &info_offset, &block_mem_offset);
     return 0;
 }
 
-int32_t KVCache::Put(uint64_t key, const char* buff, uint32_t length, bool is_overwrite)
+bool KVCache::SameLayout(const CacheMeta& lhs, const CacheMeta& rhs)
 {
-    // 至少保留一个block做为free_block
-    uint32_t need_block_num = length / m_block_size + ((length % m_block_size) == 0 ? 0 : 1);
-    if (m_free_block_size <= need_block_num + 10 || NULL == m_block_infos)
+    if (lhs._magic != rhs._magic
+        || lhs._version != rhs._version
+        || lhs._block_num != rhs._block_num
+        || lhs._class_num != rhs._class_num
+        || lhs._slot_num != rhs._slot_num
+        || lhs._max_key_num != rhs._max_key_num
+        || lhs._region_size != rhs._region_size
+        || lhs._class_num > kMAX_BLOCK_CLASS_NUM)
     {
-        PLOG_ERROR_N_EVERY_SECOND(1, "Put failed in block not enough, need %u remain %u",
-            need_block_num, m_free_block_size);
-        return -1;
+        return false;
     }
-    if (true == is_overwrite)
+    for (uint32_t idx = 0; idx < lhs._class_num; ++idx)
     {
-        Del(key);
+        const BlockClassMeta& l = lhs._classes[idx];
+        const BlockClassMeta& r = rhs._classes[idx];
+        if (l._block_size != r._block_size
+            || l._block_num != r._block_num
+            || l._first_block != r._first_block
+            || l._mem_offset != r._mem_offset)
+        {
+            return false;
+        }
     }
+    return true;
+}
 
-    std::pair<CacheMap::iterator, bool> result;
-    result = m_caches.insert(CacheMapPair(key, CacheHeadInfo()));
-    // 新插入，分配一块内存
-    if (true == result.second)
+size_t KVCache::CalcLayout(const CacheMeta& meta, size_t* slot_offset, size_t* info_offset,
+    size_t* mem_offset)
+{
+    *slot_offset = AlignCacheLine(sizeof(CacheMeta));
+    *info_offset = AlignCacheLine(*slot_offset + sizeof(CacheSlot) * meta._slot_num);
+    *mem_offset = AlignCacheLine(*info_offset + sizeof(CacheBlockInfo) * meta._block_num);
+
+    const BlockClassMeta& last = meta._classes[meta._class_num - 1];
+    return *mem_offset + last._mem_offset + static_cast<size_t>(last._block_num) * last._block_size;
+}
+
+void KVCache::BindRegion(char* region)
+{
+    m_region = region;
+    m_meta = reinterpret_cast<CacheMeta*>(region);
+
+    size_t slot_offset = 0;
+    size_t info_offset = 0;
+    size_t mem_offset = 0;
+    CalcLayout(*m_meta, &slot_offset, &info_offset, &mem_offset);
+    m_slots = reinterpret_cast<CacheSlot*>(region + slot_offset);
+    m_block_infos = reinterpret_cast<CacheBlockInfo*>(region + info_offset);
+    m_block_mem = region + mem_offset;
+
+    m_block_num = m_meta->_block_num;
+    m_slot_mask = m_meta->_slot_num - 1;
+    m_slot_shift = 64;
+    for (uint32_t n = m_meta->_slot_num; n > 1; n >>= 1)
     {
-        m_free_block_size--;
-        uint32_t malloc_block_id = m_free_block_head._first_block;
-        m_free_block_head._first_block = m_block_infos[malloc_block_id]._next_block;
+        m_slot_shift--;
+    }
+}
 
-        m_block_infos[malloc_block_id]._next_block = UINT32_MAX;
-        m_block_infos[malloc_block_id]._write_pos = 0;
-        m_block_infos[malloc_block_id]._read_pos = 0;
-        result.first->second._first_block = malloc_block_id;
-        result.first->second._last_block = malloc_block_id;
+void KVCache::ResetData()
+{
+    for (uint32_t idx = 0; idx < m_meta->_slot_num; ++idx)
+    {
+        m_slots[idx]._dist = 0;
     }
+    m_meta->_key_num = 0;
 
-    // 写入数据
-    uint32_t has_write = 0;
-    uint32_t last_block_id = result.first->second._last_block;
-    while (has_write < length)
+    // 初始化block infos，每个级别的块串成该级别的空闲链表
+    for (uint32_t class_idx = 0; class_idx < m_meta->_class_num; ++class_idx)
     {
-        uint32_t buff_sz = m_block_size - m_block_infos[last_block_id]._write_pos;
-        uint32_t remain_sz = length - has_write;
-        buff_sz = (buff_sz > remain_sz ? remain_sz : buff_sz);
+        BlockClassMeta& cls = m_meta->_classes[class_idx];
+        uint32_t end_block = cls._first_block + cls._block_num;
+        for (uint32_t idx = cls._first_block; idx < end_block; ++idx)
+        {
+            m_block_infos[idx]._write_pos = 0;
+            m_block_infos[idx]._read_pos = 0;
+            m_block_infos[idx]._next_block = idx + 1;
+        }
+        m_block_infos[end_block - 1]._next_block = UINT32_MAX;
 
-        char* cur_write = m_block_mem + last_block_id * m_block_size
-                          + m_block_infos[last_block_id]._write_pos;
-        memcpy(cur_write, buff + has_write, buff_sz);
-        m_block_infos[last_block_id]._write_pos += buff_sz;
-        has_write += buff_sz;
+        cls._free_block_head._first_block = cls._first_block;
+        cls._free_block_head._last_block = end_block - 1;
+        cls._free_block_head._block_num = cls._block_num;
+        cls._key_num = 0;
+        cls._data_size = 0;
+    }
+}
 
-        if (has_write < length)
+bool KVCache::Validate()
+{
+    // 每个block只能属于一个链表，且所有block都要被引用到
+    std::vector<bool> visited(m_block_num, false);
+    std::vector<uint32_t> used_block_num(m_meta->_class_num, 0);
+    std::vector<uint32_t> class_key_num(m_meta->_class_num, 0);
+    std::vector<uint64_t> data_size(m_meta->_class_num, 0);
+
+    uint32_t key_num = 0;
+    for (uint32_t idx = 0; idx < m_meta->_slot_num; ++idx)
+    {
+        const CacheSlot& slot = m_slots[idx];
+        if (0 == slot._dist)
+        {
+            continue;
+        }
+        if (slot._dist > m_meta->_slot_num
+            || ((HashSlot(slot._key) + slot._dist - 1) & m_slot_mask) != idx
+            || slot._class >= m_meta->_class_num)
+        {
+            return false;
+        }
+        key_num++;
+        class_key_num[slot._class]++;
+
+        const BlockClassMeta& cls = m_meta->_classes[slot._class];
+        uint32_t block_id = slot._head._first_block;
+        uint32_t last_block_id = UINT32_MAX;
+        uint32_t block_num = 0;
+        uint64_t key_data_size = 0;
+        while (block_id < m_block_num)
+        {
+            if (visited[block_id]
+                || block_id < cls._first_block
+                || block_id - cls._first_block >= cls._block_num
+                || m_block_infos[block_id]._read_pos > m_block_infos[block_id]._write_pos
+                || m_block_infos[block_id]._write_pos > cls._block_size)
+            {
+                return false;
+            }
+            visited[block_id] = true;
+            block_num++;
+            key_data_size += m_block_infos[block_id]._write_pos - m_block_infos[block_id]._read_pos;
+            last_block_id = block_id;
+            block_id = m_block_infos[block_id]._next_block;
+        }
+        if (block_id != UINT32_MAX || last_block_id != slot._head._last_block
+            || block_num != slot._head._block_num || key_data_size != slot._head._data_size)
+        {
+            return false;
+        }
+        used_block_num[slot._class] += block_num;
+        data_size[slot._class] += key_data_size;
+    }
+    if (key_num != m_meta->_key_num)
+    {
+        return false;
+    }
+
+    for (uint32_t class_idx = 0; class_idx < m_meta->_class_num; ++class_idx)
+    {
+        const BlockClassMeta& cls = m_meta->_classes[class_idx];
+        uint32_t free_block_num = 0;
+        uint32_t block_id = cls._free_block_head._first_block;
+        uint32_t last_block_id = UINT32_MAX;
+        while (block_id < m_block_num)
+        {
+            if (visited[block_id]
+                || block_id < cls._first_block
+                || block_id - cls._first_block >= cls._block_num)
+            {
+                return false;
+            }
+            visited[block_id] = true;
+            free_block_num++;
+            last_block_id = block_id;
+            block_id = m_block_infos[block_id]._next_block;
+        }
+
+        if (block_id != UINT32_MAX
+            || last_block_id != cls._free_block_head._last_block
+            || free_block_num != cls._free_block_head._block_num
+            || free_block_num + used_block_num[class_idx] != cls._block_num
+            || class_key_num[class_idx] != cls._key_num
+            || data_size[class_idx] != cls._data_size)
         {
-            m_free_block_size--;
-            m_block_infos[last_block_id]._next_block = m_free_block_head._first_block;
-            last_block_id = m_free_block_head._first_block;
-            m_free_block_head._first_block = m_block_infos[last_block_id]._next_block;
-            m_block_infos[last_block_id]._next_block = UINT32_MAX;
-            m_block_infos[last_block_id]._write_pos = 0;
-            m_block_infos[last_block_id]._read_pos = 0;
+            return false;
         }
     }
-    result.first->second._last_block = last_block_id;
+    return true;
+}
+
+int32_t KVCache::Init(uint32_t max_frame_num, uint32_t block_num, uint32_t block_size)
+{
+    BlockClass cls;
+    cls.block_size = (block_size > 0 ? block_size : m_block_size);
+    cls.block_num = (block_num > 0 ? block_num : m_block_num);
+    return Init(max_frame_num, &cls, 1);
+}
+
+int32_t KVCache::Init(uint32_t max_frame_num, const BlockClass* classes, uint32_t class_num)
+{
+    Release();
+
+    CacheMeta meta;
+    if (SetupMeta(max_frame_num, classes, class_num, &meta) != 0)
+    {
+        PLOG_ERROR("invalid kv cache block classes");
+        return -1;
+    }
 
+    char* region = new char[meta._region_size];
+    memcpy(region, &meta, sizeof(meta));
+    BindRegion(region);
+    m_region_size = meta._region_size;
+    m_is_mmap = false;
+
+    ResetData();
     return 0;
 }
 
-int32_t KVCache::Get(uint64_t key, char* buff, uint32_t length)
+int32_t KVCache::InitShm(const char* path, uint32_t max_frame_num, uint32_t block_num,
+    uint32_t block_size)
+{
+    BlockClass cls;
+    cls.block_size = (block_size > 0 ? block_size : m_block_size);
+    cls.block_num = (block_num > 0 ? block_num : m_block_num);
+    return InitShm(path, max_frame_num, &cls, 1);
+}
+
+int32_t KVCache::InitShm(const char* path, uint32_t max_frame_num, const BlockClass* classes,
+    uint32_t class_num)
 {
-    CacheMap::iterator it = m_caches.find(key);
-    if (NULL == buff || 0 == length || it == m_caches.end())
+    if (NULL == path)
     {
-        return 0;
+        return -1;
     }
+    Release();
 
-    uint32_t has_read = 0;
-    uint32_t first_block_id = it->second._first_block;
-    while (first_block_id < m_block_num && has_read < length)
+    CacheMeta meta;
+    if (SetupMeta(max_frame_num, classes, class_num, &meta) != 0)
     {
-        uint32_t buff_sz = length - has_read;
-        uint32_t remain_sz = m_block_infos[first_block_id]._write_pos
-                             - m_block_infos[first_block_id]._read_pos;
-        buff_sz = (buff_sz < remain_sz ? buff_sz : remain_sz);
+        PLOG_ERROR("invalid kv cache block classes");
+        return -1;
+    }
 
-        char* cur_read = m_block_mem + first_block_id * m_block_size
-                         + m_block_infos[first_block_id]._read_pos;
-        memcpy(buff + has_read, cur_read, buff_sz);
-        m_block_infos[first_block_id]._read_pos += buff_sz;
-        has_read += buff_sz;
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+    {
+        PLOG_ERROR("open %s failed(%s)", path, strerror(errno));
+        return -1;
+    }
 
-        // block读取了所有的数据了
-        if (buff_sz == remain_sz)
-        {
-            m_block_infos[m_free_block_head._last_block]._next_block = first_block_id;
-            m_free_block_head._last_block = first_block_id;
-            first_block_id = m_block_infos[first_block_id]._next_block;
-            m_block_infos[m_free_block_head._last_block]._next_block = UINT32_MAX;
-            m_free_block_size++;
-        }
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        PLOG_ERROR("fstat %s failed(%s)", path, strerror(errno));
+        close(fd);
+        return -1;
     }
-    it->second._first_block = first_block_id;
-    // 所有的数据都读取完了，删除
-    if (first_block_id >= m_block_num)
+    bool exist = (static_cast<uint64_t>(st.st_size) == meta._region_size);
+    if (!exist && ftruncate(fd, meta._region_size) != 0)
     {
-        m_caches.erase(it);
+        PLOG_ERROR("ftruncate %s to %lu failed(%s)", path, meta._region_size, strerror(errno));
+        close(fd);
+        return -1;
     }
-    return static_cast<int32_t>(has_read);
+
+    void* addr = mmap(NULL, meta._region_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == addr)
+    {
+        PLOG_ERROR("mmap %s size %lu failed(%s)", path, meta._region_size, strerror(errno));
+        return -1;
+    }
+
+    char* region = static_cast<char*>(addr);
+    // 配置一致才按已有数据挂载
+    exist = exist && SameLayout(*reinterpret_cast<const CacheMeta*>(region), meta);
+
+    if (!exist)
+    {
+        memcpy(region, &meta, sizeof(meta));
+    }
+    BindRegion(region);
+    m_region_size = meta._region_size;
+    m_is_mmap = true;
+
+    if (exist && Validate())
+    {
+        PLOG_INFO("reattach kv cache %s, %u keys", path, m_meta->_key_num);
+        return 1;
+    }
+
+    PLOG_IF_ERROR(exist, "kv cache %s validate failed, reinitialize", path);
+    // 校验失败时元信息可能已损坏，重新写入
+    memcpy(region, &meta, sizeof(meta));
+    ResetData();
+    return 0;
 }
 
-int32_t KVCache::Peek(uint64_t key, char* buff, uint32_t length)
+KVCache::CacheSlot* KVCache::FindSlot(uint64_t key)
 {
-    CacheMap::iterator it = m_caches.find(key);
-    if (NULL == buff || 0 == length || it == m_caches.end())
+    if (NULL == m_slots)
     {
-        return 0;
+        return NULL;
     }
 
-    uint32_t has_read = 0;
-    uint32_t first_block_id = it->second._first_block;
-    while (first_block_id < m_block_num && has_read < length)
+    uint32_t idx = HashSlot(key);
+    for (uint32_t dist = 1; ; ++dist)
     {
-        uint32_t buff_sz = length - has_read;
-        uint32_t remain_sz = m_block_infos[first_block_id]._write_pos
-            - m_block_infos[first_block_id]._read_pos;
-        buff_sz = (buff_sz < remain_sz ? buff_sz : remain_sz);
+        CacheSlot* slot = m_slots + idx;
+        // Robin Hood: 遇到空槽或探测距离更短的槽位，说明key不存在
+        if (slot->_dist < dist)
+        {
+            return NULL;
+        }
+        if (slot->_key == key)
+        {
+            return slot;
+        }
+        idx = (idx + 1) & m_slot_mask;
+    }
+}
 
-        char* cur_read = m_block_mem + first_block_id * m_block_size
-            + m_block_infos[first_block_id]._read_pos;
-        memcpy(buff + has_read, cur_read, buff_sz);
-        has_read += buff_sz;
+KVCache::CacheSlot* KVCache::InsertSlot(uint64_t key, bool* inserted)
+{
+    *inserted = false;
+    CacheSlot* found = FindSlot(key);
+    if (NULL != found)
+    {
+        return found;
+    }
+    if (NULL == m_slots || m_meta->_key_num >= m_meta->_max_key_num)
+    {
+        return NULL;
+    }
 
-        // block读取了所有的数据了
-        if (buff_sz == remain_sz)
+    CacheSlot cur;
+    cur._key = key;
+    cur._dist = 1;
+    cur._referenced = 1;
+    cur._class = 0;
+    cur._head = CacheHeadInfo();
+    cur._expire_time = 0;
+
+    CacheSlot* result = NULL;
+    uint32_t idx = HashSlot(key);
+    while (true)
+    {
+        CacheSlot* slot = m_slots + idx;
+        if (0 == slot->_dist)
         {
-            first_block_id = m_block_infos[first_block_id]._next_block;
+            *slot = cur;
+            if (NULL == result)
+            {
+                result = slot;
+            }
+            break;
         }
+        // 劫富济贫：探测距离更短的元素让出槽位，继续为其寻找位置
+        if (slot->_dist < cur._dist)
+        {
+            std::swap(*slot, cur);
+            if (NULL == result)
+            {
+                result = slot;
+            }
+        }
+        cur._dist++;
+        idx = (idx + 1) & m_slot_mask;
     }
 
-    return static_cast<int32_t>(has_read);
+    m_meta->_key_num++;
+    *inserted = true;
+    return result;
 }
 
-int32_t KVCache::GetSize(uint64_t key)
+void KVCache::EraseSlot(CacheSlot* slot)
 {
-    CacheMap::iterator it = m_caches.find(key);
-    if (it == m_caches.end())
+    // backward shift删除，不使用墓碑，保持探测链紧凑
+    m_meta->_classes[slot->_class]._key_num--;
+    uint32_t idx = static_cast<uint32_t>(slot - m_slots);
+    uint32_t next = (idx + 1) & m_slot_mask;
+    while (m_slots[next]._dist > 1)
     {
-        return 0;
+        m_slots[idx] = m_slots[next];
+        m_slots[idx]._dist--;
+        idx = next;
+        next = (next + 1) & m_slot_mask;
     }
+    m_slots[idx]._dist = 0;
+    m_meta->_key_num--;
+}
 
-    uint32_t total_len = 0;
-    uint32_t first_block_id = it->second._first_block;
-    while (first_block_id < m_block_num)
+uint32_t KVCache::SelectClass(uint32_t length) const
+{
+    // 优先选择一块能装下的最小级别，都装不下时选最大级别
+    uint32_t class_num = m_meta->_class_num;
+    uint32_t prefer = 0;
+    while (prefer + 1 < class_num && m_meta->_classes[prefer]._block_size < length)
     {
-        uint32_t remain_sz = m_block_infos[first_block_id]._write_pos
-            - m_block_infos[first_block_id]._read_pos;
+        prefer++;
+    }
 
-        total_len += remain_sz;
-        first_block_id = m_block_infos[first_block_id]._next_block;
+    // 空间不足时依次尝试更大的级别，再尝试更小的级别(块链更长)
+    for (uint32_t idx = prefer; idx < class_num; ++idx)
+    {
+        if (m_meta->_classes[idx]._free_block_head._block_num
+            >= std::max(CalcBlockNum(idx, length), 1u))
+        {
+            return idx;
+        }
+    }
+    for (uint32_t idx = prefer; idx > 0; --idx)
+    {
+        if (m_meta->_classes[idx - 1]._free_block_head._block_num
+            >= std::max(CalcBlockNum(idx - 1, length), 1u))
+        {
+            return idx - 1;
+        }
     }
-    return total_len;
+    return prefer;
 }
 
-int32_t KVCache::Del(uint64_t key)
+uint32_t KVCache::AllocBlock(uint32_t class_idx)
+{
+    BlockClassMeta& cls = m_meta->_classes[class_idx];
+    uint32_t block_id = cls._free_block_head._first_block;
+    cls._free_block_head._first_block = m_block_infos[block_id]._next_block;
+    if (UINT32_MAX == cls._free_block_head._first_block)
+    {
+        cls._free_block_head._last_block = UINT32_MAX;
+    }
+    cls._free_block_head._block_num--;
+
+    m_block_infos[block_id]._next_block = UINT32_MAX;
+    m_block_infos[block_id]._write_pos = 0;
+    m_block_infos[block_id]._read_pos = 0;
+    return block_id;
+}
+
+void KVCache::FreeBlock(uint32_t class_idx, uint32_t block_id)
+{
+    BlockClassMeta& cls = m_meta->_classes[class_idx];
+    m_block_infos[block_id]._next_block = UINT32_MAX;
+    if (UINT32_MAX == cls._free_block_head._last_block)
+    {
+        cls._free_block_head._first_block = block_id;
+    }
+    else
+    {
+        m_block_infos[cls._free_block_head._last_block]._next_block = block_id;
+    }
+    cls._free_block_head._last_block = block_id;
+    cls._free_block_head._block_num++;
+}
+
+int32_t KVCache::Put(uint64_t key, const char* buff, uint32_t length, bool is_overwrite)
 {
-    CacheMap::iterator it = m_caches.find(key);
-    if (it == m_caches.end())
+    if (NULL == m_meta)
     {
         return -1;
     }
+    OpSampler sampler(this, kOP_PUT);
+    m_stats.put_num++;
 
-    m_block_infos[m_free_block_head._last_block]._next_block = it->second._first_block;
-    m_free_block_head._last_block = it->second._last_block;
-    m_block_infos[m_free_block_head._last_block]._next_block = UINT32_MAX;
+    // 追加写沿用key已选的级别，新key(包括覆盖写)按本次写入长度选择级别
+    uint32_t class_idx = 0;
+    uint32_t need_block_num = 0;
+    CacheSlot* slot = (is_overwrite ? NULL : FindLiveSlot(key));
+    if (NULL != slot)
+    {
+        class_idx = slot->_class;
+        uint32_t room = m_meta->_classes[class_idx]._block_size
+            - m_block_infos[slot->_head._last_block]._write_pos;
+        need_block_num = CalcBlockNum(class_idx, length > room ? length - room : 0);
+    }
+    else
+    {
+        class_idx = SelectClass(length);
+        need_block_num = std::max(CalcBlockNum(class_idx, length), 1u);
+    }
 
-    uint32_t first_block_id = it->second._first_block;
-    while (first_block_id < m_block_num)
+    BlockClassMeta& cls = m_meta->_classes[class_idx];
+    if (cls._free_block_head._block_num < need_block_num && kEVICT_CLOCK == m_evict_policy)
     {
-        first_block_id = m_block_infos[first_block_id]._next_block;
-        m_free_block_size++;
+        Evict(class_idx, need_block_num, key, UINT32_MAX);
     }
-    m_caches.erase(it);
-    return 0;
+    if (cls._free_block_head._block_num < need_block_num)
+    {
+        PLOG_ERROR_N_EVERY_SECOND(1, "Put failed in block not enough, block size %u need %u "
+            "remain %u", cls._block_size, need_block_num, cls._free_block_head._block_num);
+        m_stats.put_fail_num++;
+        return -1;
+    }
+    if (true == is_overwrite)
+    {
+        slot = FindSlot(key);
+        if (NULL != slot)
+        {
+            DelSlot(slot);
+        }
+    }
+
+    bool inserted = false;
+    slot = InsertSlot(key, &inserted);
+    if (NULL == slot && kEVICT_CLOCK == m_evict_policy && Evict(kANY_CLASS, 0, key, 1) > 0)
+    {
+        slot = InsertSlot(key, &inserted);
+    }
+    if (NULL == slot)
+    {
+        PLOG_ERROR_N_EVERY_SECOND(1, "Put failed in key num reach limit %u", m_meta->_max_key_num);
+        m_stats.put_fail_num++;
+        return -1;
+    }
+    slot->_referenced = 1;
+    // 新插入，分配一块内存
+    if (true == inserted)
+    {
+        InitSlotBlocks(slot, class_idx);
+    }
+    WriteSlot(slot, buff, length);
+
+    return 0;
+}
+
+void KVCache::InitSlotBlocks(CacheSlot* slot, uint32_t class_idx)
+{
+    slot->_class = static_cast<uint16_t>(class_idx);
+    m_meta->_classes[class_idx]._key_num++;
+    uint32_t malloc_block_id = AllocBlock(class_idx);
+    slot->_head._first_block = malloc_block_id;
+    slot->_head._last_block = malloc_block_id;
+    slot->_head._block_num = 1;
+    slot->_head._data_size = 0;
+}
+
+void KVCache::WriteSlot(CacheSlot* slot, const char* buff, uint32_t length)
+{
+    uint32_t class_idx = slot->_class;
+    BlockClassMeta& cls = m_meta->_classes[class_idx];
+    uint32_t has_write = 0;
+    uint32_t last_block_id = slot->_head._last_block;
+    while (has_write < length)
+    {
+        uint32_t buff_sz = cls._block_size - m_block_infos[last_block_id]._write_pos;
+        uint32_t remain_sz = length - has_write;
+        buff_sz = (buff_sz > remain_sz ? remain_sz : buff_sz);
+
+        char* cur_write = BlockData(class_idx, last_block_id)
+                          + m_block_infos[last_block_id]._write_pos;
+        memcpy(cur_write, buff + has_write, buff_sz);
+        m_block_infos[last_block_id]._write_pos += buff_sz;
+        has_write += buff_sz;
+
+        if (has_write < length)
+        {
+            uint32_t next_block_id = AllocBlock(class_idx);
+            m_block_infos[last_block_id]._next_block = next_block_id;
+            last_block_id = next_block_id;
+            slot->_head._block_num++;
+        }
+    }
+    slot->_head._last_block = last_block_id;
+    slot->_head._data_size += length;
+    cls._data_size += length;
+}
+
+int32_t KVCache::Get(uint64_t key, char* buff, uint32_t length)
+{
+    if (NULL == buff)
+    {
+        return 0;
+    }
+    OpSampler sampler(this, kOP_GET);
+    CacheSlot* slot = FindLiveSlot(key);
+    if (NULL == slot)
+    {
+        m_stats.miss_num++;
+        return 0;
+    }
+    m_stats.hit_num++;
+    return ReadSlot(slot, buff, length, true);
+}
+
+int32_t KVCache::Peek(uint64_t key, char* buff, uint32_t length)
+{
+    if (NULL == buff)
+    {
+        return 0;
+    }
+    OpSampler sampler(this, kOP_PEEK);
+    CacheSlot* slot = FindLiveSlot(key);
+    if (NULL == slot)
+    {
+        m_stats.miss_num++;
+        return 0;
+    }
+    m_stats.hit_num++;
+    return ReadSlot(slot, buff, length, false);
+}
+
+int32_t KVCache::PeekV(uint64_t key, struct iovec* iov, uint32_t iov_num, uint32_t length)
+{
+    if (NULL == iov || 0 == iov_num || 0 == length)
+    {
+        return 0;
+    }
+    OpSampler sampler(this, kOP_PEEKV);
+    CacheSlot* slot = FindLiveSlot(key);
+    if (NULL == slot)
+    {
+        m_stats.miss_num++;
+        return 0;
+    }
+    m_stats.hit_num++;
+
+    uint32_t has_read = 0;
+    uint32_t iov_cnt = 0;
+    uint32_t first_block_id = slot->_head._first_block;
+    while (first_block_id < m_block_num && has_read < length && iov_cnt < iov_num)
+    {
+        uint32_t buff_sz = length - has_read;
+        uint32_t remain_sz = m_block_infos[first_block_id]._write_pos
+            - m_block_infos[first_block_id]._read_pos;
+        buff_sz = (buff_sz < remain_sz ? buff_sz : remain_sz);
+
+        if (buff_sz > 0)
+        {
+            iov[iov_cnt].iov_base = BlockData(slot->_class, first_block_id)
+                + m_block_infos[first_block_id]._read_pos;
+            iov[iov_cnt].iov_len = buff_sz;
+            iov_cnt++;
+            has_read += buff_sz;
+        }
+
+        first_block_id = m_block_infos[first_block_id]._next_block;
+    }
+
+    return static_cast<int32_t>(iov_cnt);
+}
+
+int32_t KVCache::Consume(uint64_t key, uint32_t length)
+{
+    OpSampler sampler(this, kOP_CONSUME);
+    CacheSlot* slot = FindLiveSlot(key);
+    if (NULL == slot)
+    {
+        m_stats.miss_num++;
+        return 0;
+    }
+    m_stats.hit_num++;
+    return ReadSlot(slot, NULL, length, true);
+}
+
+int32_t KVCache::ReadSlot(CacheSlot* slot, char* buff, uint32_t length, bool remove)
+{
+    if (0 == length)
+    {
+        return 0;
+    }
+
+    uint32_t class_idx = slot->_class;
+    uint32_t has_read = 0;
+    uint32_t first_block_id = slot->_head._first_block;
+    while (first_block_id < m_block_num && has_read < length)
+    {
+        uint32_t buff_sz = length - has_read;
+        uint32_t read_pos = m_block_infos[first_block_id]._read_pos;
+        uint32_t remain_sz = m_block_infos[first_block_id]._write_pos - read_pos;
+        buff_sz = (buff_sz < remain_sz ? buff_sz : remain_sz);
+
+        // buff为NULL时只释放数据(Consume)，不拷贝
+        if (NULL != buff)
+        {
+            char* cur_read = BlockData(class_idx, first_block_id) + read_pos;
+            memcpy(buff + has_read, cur_read, buff_sz);
+        }
+        has_read += buff_sz;
+
+        if (!remove)
+        {
+            if (buff_sz == remain_sz)
+            {
+                first_block_id = m_block_infos[first_block_id]._next_block;
+            }
+            continue;
+        }
+
+        m_block_infos[first_block_id]._read_pos += buff_sz;
+        // block读取了所有的数据了
+        if (buff_sz == remain_sz)
+        {
+            uint32_t next_block_id = m_block_infos[first_block_id]._next_block;
+            FreeBlock(class_idx, first_block_id);
+            first_block_id = next_block_id;
+            slot->_head._block_num--;
+        }
+    }
+
+    if (remove)
+    {
+        m_meta->_classes[class_idx]._data_size -= has_read;
+        slot->_head._data_size -= has_read;
+        slot->_head._first_block = first_block_id;
+        // 所有的数据都读取完了，删除
+        if (first_block_id >= m_block_num)
+        {
+            EraseSlot(slot);
+        }
+    }
+    return static_cast<int32_t>(has_read);
+}
+
+int32_t KVCache::GetSize(uint64_t key)
+{
+    OpSampler sampler(this, kOP_GET_SIZE);
+    CacheSlot* slot = FindLiveSlot(key);
+    if (NULL == slot)
+    {
+        return 0;
+    }
+    return slot->_head._data_size;
+}
+
+int32_t KVCache::Del(uint64_t key)
+{
+    OpSampler sampler(this, kOP_DEL);
+    CacheSlot* slot = FindSlot(key);
+    if (NULL == slot)
+    {
+        return -1;
+    }
+    DelSlot(slot);
+    return 0;
+}
+
+KVCache::CacheSlot* KVCache::FindLiveSlot(uint64_t key)
+{
+    CacheSlot* slot = FindSlot(key);
+    if (NULL == slot)
+    {
+        return NULL;
+    }
+    if (slot->_expire_time != 0 && TimeUtility::GetCurrentMS() >= slot->_expire_time)
+    {
+        DelSlot(slot);
+        m_stats.expire_num++;
+        return NULL;
+    }
+    slot->_referenced = 1;
+    return slot;
+}
+
+void KVCache::FreeBlocks(uint32_t class_idx, const CacheHeadInfo& head)
+{
+    if (head._first_block >= m_block_num)
+    {
+        return;
+    }
+
+    // 整条链表接到空闲链表尾部，不需要遍历
+    BlockClassMeta& cls = m_meta->_classes[class_idx];
+    if (UINT32_MAX == cls._free_block_head._last_block)
+    {
+        cls._free_block_head._first_block = head._first_block;
+    }
+    else
+    {
+        m_block_infos[cls._free_block_head._last_block]._next_block = head._first_block;
+    }
+    cls._free_block_head._last_block = head._last_block;
+    cls._free_block_head._block_num += head._block_num;
+    cls._data_size -= head._data_size;
+}
+
+void KVCache::DelSlot(CacheSlot* slot)
+{
+    FreeBlocks(slot->_class, slot->_head);
+    EraseSlot(slot);
+}
+
+uint32_t KVCache::Evict(uint32_t class_idx, uint32_t need_free_block_num, uint64_t skip_key,
+    uint32_t max_evict_key_num)
+{
+    uint32_t evict_num = 0;
+    // 指针最多转两圈：第一圈清除访问位，第二圈一定能找到可淘汰的key
+    // 删除时指针不动，不计入步数，删除次数受key数和max_evict_key_num限制
+    uint64_t max_step = static_cast<uint64_t>(m_meta->_slot_num) * 2;
+    uint64_t step = 0;
+    int64_t now = TimeUtility::GetCurrentMS();
+    while (step < max_step && evict_num < max_evict_key_num)
+    {
+        if (evict_num > 0 && (kANY_CLASS == class_idx
+            || m_meta->_classes[class_idx]._free_block_head._block_num >= need_free_block_num))
+        {
+            break;
+        }
+
+        CacheSlot* slot = m_slots + m_clock_hand;
+        if (0 == slot->_dist || slot->_key == skip_key
+            || (kANY_CLASS != class_idx && slot->_class != class_idx))
+        {
+            m_clock_hand = (m_clock_hand + 1) & m_slot_mask;
+            ++step;
+            continue;
+        }
+
+        bool expired = (slot->_expire_time != 0 && now >= slot->_expire_time);
+        if (!expired && slot->_referenced != 0)
+        {
+            slot->_referenced = 0;
+            m_clock_hand = (m_clock_hand + 1) & m_slot_mask;
+            ++step;
+            continue;
+        }
+
+        // 删除后后续槽位前移，指针不动继续检查当前位置
+        DelSlot(slot);
+        evict_num++;
+        if (expired)
+        {
+            m_stats.expire_num++;
+        }
+        else
+        {
+            m_stats.evict_num++;
+        }
+    }
+
+    return evict_num;
+}
+
+void KVCache::PrefetchAhead(const uint64_t* keys, uint32_t key_num, uint32_t idx, bool tail)
+{
+    if (idx + kPREFETCH_DISTANCE < key_num)
+    {
+        __builtin_prefetch(m_slots + HashSlot(keys[idx + kPREFETCH_DISTANCE]));
+    }
+    if (idx + kPREFETCH_DISTANCE / 2 < key_num)
+    {
+        const CacheSlot* slot = FindSlot(keys[idx + kPREFETCH_DISTANCE / 2]);
+        if (NULL != slot)
+        {
+            uint32_t block_id = (tail ? slot->_head._last_block : slot->_head._first_block);
+            __builtin_prefetch(m_block_infos + block_id);
+            __builtin_prefetch(BlockData(slot->_class, block_id));
+        }
+    }
+}
+
+int32_t KVCache::MultiGet(const uint64_t* keys, uint32_t key_num, const struct iovec* buffs,
+    int32_t* results)
+{
+    if (NULL == keys || NULL == buffs || NULL == m_meta)
+    {
+        return 0;
+    }
+
+    int32_t hit_num = 0;
+    for (uint32_t idx = 0; idx < key_num; ++idx)
+    {
+        PrefetchAhead(keys, key_num, idx, false);
+        int32_t ret = Get(keys[idx], static_cast<char*>(buffs[idx].iov_base),
+            static_cast<uint32_t>(buffs[idx].iov_len));
+        if (ret > 0)
+        {
+            hit_num++;
+        }
+        if (NULL != results)
+        {
+            results[idx] = ret;
+        }
+    }
+    return hit_num;
+}
+
+int32_t KVCache::MultiPut(const uint64_t* keys, uint32_t key_num, const struct iovec* values,
+    bool is_overwrite, int32_t* results)
+{
+    if (NULL == keys || NULL == values || NULL == m_meta)
+    {
+        return 0;
+    }
+
+    int32_t succ_num = 0;
+    for (uint32_t idx = 0; idx < key_num; ++idx)
+    {
+        // 覆盖写会释放原有块，只需预取槽位
+        if (is_overwrite)
+        {
+            if (idx + kPREFETCH_DISTANCE < key_num)
+            {
+                __builtin_prefetch(m_slots + HashSlot(keys[idx + kPREFETCH_DISTANCE]));
+            }
+        }
+        else
+        {
+            PrefetchAhead(keys, key_num, idx, true);
+        }
+        int32_t ret = Put(keys[idx], static_cast<const char*>(values[idx].iov_base),
+            static_cast<uint32_t>(values[idx].iov_len), is_overwrite);
+        if (0 == ret)
+        {
+            succ_num++;
+        }
+        if (NULL != results)
+        {
+            results[idx] = ret;
+        }
+    }
+    return succ_num;
+}
+
+int32_t KVCache::MultiDel(const uint64_t* keys, uint32_t key_num, int32_t* results)
+{
+    if (NULL == keys || NULL == m_meta)
+    {
+        return 0;
+    }
+
+    int32_t del_num = 0;
+    for (uint32_t idx = 0; idx < key_num; ++idx)
+    {
+        // Del只访问槽位和空闲链表尾，不需要预取块
+        if (idx + kPREFETCH_DISTANCE < key_num)
+        {
+            __builtin_prefetch(m_slots + HashSlot(keys[idx + kPREFETCH_DISTANCE]));
+        }
+        int32_t ret = Del(keys[idx]);
+        if (0 == ret)
+        {
+            del_num++;
+        }
+        if (NULL != results)
+        {
+            results[idx] = ret;
+        }
+    }
+    return del_num;
+}
+
+int32_t KVCache::Snapshot(const char* path)
+{
+    if (NULL == path || NULL == m_meta)
+    {
+        return -1;
+    }
+
+    std::string tmp_path(path);
+    tmp_path.append(".tmp");
+    int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        PLOG_ERROR("open %s failed(%s)", tmp_path.c_str(), strerror(errno));
+        return -1;
+    }
+
+    // 栈上放不下攒批的数据段和记录头
+    SnapshotWriter* writer = new SnapshotWriter(fd);
+    SnapshotHeader header;
+    header._magic = kSNAPSHOT_MAGIC;
+    header._version = kSNAPSHOT_VERSION;
+    header._reserved = 0;
+    writer->Add(&header, sizeof(header));
+
+    SnapshotTail tail;
+    tail._magic = kSNAPSHOT_MAGIC;
+    tail._key_num = 0;
+    tail._data_size = 0;
+    int64_t now = TimeUtility::GetCurrentMS();
+    for (uint32_t idx = 0; idx < m_meta->_slot_num; ++idx)
+    {
+        const CacheSlot& slot = m_slots[idx];
+        if (0 == slot._dist || (slot._expire_time != 0 && now >= slot._expire_time))
+        {
+            continue;
+        }
+
+        SnapshotRecord record;
+        record._key = slot._key;
+        record._expire_time = slot._expire_time;
+        record._data_size = slot._head._data_size;
+        record._reserved = 0;
+        writer->AddRecord(record);
+
+        // 块数据直接引用缓存内存，不拷贝
+        uint32_t block_id = slot._head._first_block;
+        while (block_id < m_block_num)
+        {
+            const CacheBlockInfo& info = m_block_infos[block_id];
+            writer->Add(BlockData(slot._class, block_id) + info._read_pos,
+                info._write_pos - info._read_pos);
+            block_id = info._next_block;
+        }
+
+        tail._key_num++;
+        tail._data_size += slot._head._data_size;
+    }
+    writer->Add(&tail, sizeof(tail));
+
+    // 记录第一个失败的步骤及其errno，后续的系统调用会覆盖errno
+    const char* failed_step = NULL;
+    int err = 0;
+    if (writer->Flush() != 0)
+    {
+        failed_step = "write";
+        err = writer->GetErrno();
+    }
+    delete writer;
+
+    if (close(fd) != 0 && NULL == failed_step)
+    {
+        failed_step = "close";
+        err = errno;
+    }
+    if (NULL == failed_step && rename(tmp_path.c_str(), path) != 0)
+    {
+        failed_step = "rename";
+        err = errno;
+    }
+    if (NULL != failed_step)
+    {
+        PLOG_ERROR("%s kv cache snapshot %s failed(%s)", failed_step, tmp_path.c_str(),
+            strerror(err));
+        unlink(tmp_path.c_str());
+        return -1;
+    }
+
+    PLOG_INFO("kv cache snapshot %s, %lu keys, %lu bytes", path, tail._key_num, tail._data_size);
+    return static_cast<int32_t>(tail._key_num);
+}
+
+int32_t KVCache::Restore(const char* path)
+{
+    if (NULL == path || NULL == m_meta)
+    {
+        return -1;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        PLOG_ERROR("open %s failed(%s)", path, strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0
+        || static_cast<size_t>(st.st_size) < sizeof(SnapshotHeader) + sizeof(SnapshotTail))
+    {
+        PLOG_ERROR("kv cache snapshot %s size invalid", path);
+        close(fd);
+        return -1;
+    }
+    size_t file_size = static_cast<size_t>(st.st_size);
+    void* addr = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (MAP_FAILED == addr)
+    {
+        PLOG_ERROR("mmap %s size %lu failed(%s)", path, file_size, strerror(errno));
+        return -1;
+    }
+    madvise(addr, file_size, MADV_SEQUENTIAL);
+
+    // 先完整校验，校验失败时不改动缓存；记录按数据长度紧密排列，不保证对齐，拷贝后访问
+    const char* data = static_cast<const char*>(addr);
+    size_t end = file_size - sizeof(SnapshotTail);
+    SnapshotHeader header;
+    SnapshotTail tail;
+    SnapshotRecord record;
+    memcpy(&header, data, sizeof(header));
+    memcpy(&tail, data + end, sizeof(tail));
+    size_t pos = sizeof(SnapshotHeader);
+    uint64_t key_num = 0;
+    uint64_t data_size = 0;
+    while (pos + sizeof(SnapshotRecord) <= end)
+    {
+        memcpy(&record, data + pos, sizeof(record));
+        pos += sizeof(SnapshotRecord) + record._data_size;
+        key_num++;
+        data_size += record._data_size;
+    }
+    if (header._magic != kSNAPSHOT_MAGIC || header._version != kSNAPSHOT_VERSION
+        || pos != end || tail._magic != kSNAPSHOT_MAGIC
+        || tail._key_num != key_num || tail._data_size != data_size)
+    {
+        PLOG_ERROR("kv cache snapshot %s validate failed", path);
+        munmap(addr, file_size);
+        return -1;
+    }
+
+    // 批量重建：清空后直接插入索引并写块，不走Put的查找、覆盖及淘汰流程
+    ResetData();
+    int64_t now = TimeUtility::GetCurrentMS();
+    uint32_t restore_num = 0;
+    uint32_t drop_num = 0;
+    pos = sizeof(SnapshotHeader);
+    while (pos < end)
+    {
+        memcpy(&record, data + pos, sizeof(record));
+        const char* value = data + pos + sizeof(SnapshotRecord);
+        pos += sizeof(SnapshotRecord) + record._data_size;
+        if (record._expire_time != 0 && now >= record._expire_time)
+        {
+            continue;
+        }
+
+        uint32_t class_idx = SelectClass(record._data_size);
+        uint32_t need_block_num = std::max(CalcBlockNum(class_idx, record._data_size), 1u);
+        bool inserted = false;
+        CacheSlot* slot = NULL;
+        if (m_meta->_classes[class_idx]._free_block_head._block_num >= need_block_num)
+        {
+            slot = InsertSlot(record._key, &inserted);
+        }
+        if (NULL == slot || !inserted)
+        {
+            drop_num++;
+            continue;
+        }
+        slot->_expire_time = record._expire_time;
+        InitSlotBlocks(slot, class_idx);
+        WriteSlot(slot, value, record._data_size);
+        restore_num++;
+    }
+    munmap(addr, file_size);
+
+    PLOG_INFO("kv cache restore %s, %u keys restored, %u dropped", path, restore_num, drop_num);
+    return static_cast<int32_t>(restore_num);
+}
+
+int32_t KVCache::SetTTL(uint64_t key, uint32_t ttl_ms)
+{
+    CacheSlot* slot = FindLiveSlot(key);
+    if (NULL == slot)
+    {
+        return -1;
+    }
+    slot->_expire_time = (ttl_ms > 0 ? TimeUtility::GetCurrentMS() + ttl_ms : 0);
+    return 0;
+}
+
+int32_t KVCache::ExpireScan(uint32_t scan_num)
+{
+    if (NULL == m_meta)
+    {
+        return 0;
+    }
+
+    int32_t expire_num = 0;
+    int64_t now = TimeUtility::GetCurrentMS();
+    scan_num = std::min(scan_num, m_meta->_slot_num);
+    for (uint32_t i = 0; i < scan_num; ++i)
+    {
+        CacheSlot* slot = m_slots + m_expire_cursor;
+        if (slot->_dist != 0 && slot->_expire_time != 0 && now >= slot->_expire_time)
+        {
+            // 删除后后续槽位前移，游标不动
+            DelSlot(slot);
+            expire_num++;
+            continue;
+        }
+        m_expire_cursor = (m_expire_cursor + 1) & m_slot_mask;
+    }
+
+    m_stats.expire_num += expire_num;
+    return expire_num;
+}
+
+int32_t KVCache::StartExpireTimer(Timer* timer, uint32_t interval_ms, uint32_t scan_num)
+{
+    if (NULL == timer)
+    {
+        return -1;
+    }
+    if (NULL != m_expire_timer)
+    {
+        m_expire_timer->StopTimer(m_expire_timer_id);
+    }
+
+    int64_t timer_id = timer->StartTimer(interval_ms,
+        cxx::bind(&KVCache::OnExpireTimer, this, scan_num));
+    if (timer_id < 0)
+    {
+        m_expire_timer = NULL;
+        m_expire_timer_id = -1;
+        return static_cast<int32_t>(timer_id);
+    }
+    m_expire_timer = timer;
+    m_expire_timer_id = timer_id;
+    return 0;
+}
+
+int32_t KVCache::OnExpireTimer(uint32_t scan_num)
+{
+    ExpireScan(scan_num);
+    return kTIMER_BE_CONTINUED;
+}
+
+void KVCache::GetStats(Stats* stats) const
+{
+    if (NULL != stats)
+    {
+        *stats = m_stats;
+    }
+}
+
+int32_t KVCache::GetCacheInfo(CacheInfo* info) const
+{
+    if (NULL == info || NULL == m_meta)
+    {
+        return -1;
+    }
+
+    info->key_num = m_meta->_key_num;
+    info->max_key_num = m_meta->_max_key_num;
+    info->slot_num = m_meta->_slot_num;
+    info->block_num = m_meta->_block_num;
+    info->free_block_num = 0;
+    info->data_size = 0;
+    info->alloc_size = 0;
+    info->region_size = m_meta->_region_size;
+    info->max_chain_len = 0;
+    info->max_probe_len = 0;
+    for (uint32_t idx = 0; idx < kHIST_BUCKET_NUM; ++idx)
+    {
+        info->chain_len_hist[idx] = 0;
+        info->probe_len_hist[idx] = 0;
+    }
+
+    for (uint32_t idx = 0; idx < m_meta->_class_num; ++idx)
+    {
+        const BlockClassMeta& cls = m_meta->_classes[idx];
+        uint32_t free_block_num = cls._free_block_head._block_num;
+        info->free_block_num += free_block_num;
+        info->data_size += cls._data_size;
+        info->alloc_size += static_cast<uint64_t>(cls._block_num - free_block_num)
+            * cls._block_size;
+    }
+
+    for (uint32_t idx = 0; idx < m_meta->_slot_num; ++idx)
+    {
+        const CacheSlot& slot = m_slots[idx];
+        if (0 == slot._dist)
+        {
+            continue;
+        }
+        uint32_t chain_len = slot._head._block_num;
+        uint32_t bucket = (chain_len > 1 ? 31 - __builtin_clz(chain_len) : 0);
+        info->chain_len_hist[std::min(bucket, kHIST_BUCKET_NUM - 1)]++;
+        info->max_chain_len = std::max(info->max_chain_len, chain_len);
+
+        info->probe_len_hist[std::min(slot._dist - 1, kHIST_BUCKET_NUM - 1)]++;
+        info->max_probe_len = std::max(info->max_probe_len, slot._dist);
+    }
+    return 0;
+}
+
+/// @brief 将分布统计格式化为"下界:个数"列表，省略空桶
+template <typename T>
+static std::string FormatHist(const T* hist, uint32_t bucket_num, bool log2_bucket)
+{
+    std::string result;
+    char buff[64];
+    for (uint32_t idx = 0; idx < bucket_num; ++idx)
+    {
+        if (0 == hist[idx])
+        {
+            continue;
+        }
+        uint64_t lower = (log2_bucket ? (1ULL << idx) : idx + 1);
+        snprintf(buff, sizeof(buff), "%s%lu:%lu", result.empty() ? "" : ",",
+            lower, static_cast<uint64_t>(hist[idx]));
+        result.append(buff);
+    }
+    return result;
+}
+
+void KVCache::WriteStatLog(const char* name)
+{
+    CacheInfo info;
+    if (GetCacheInfo(&info) != 0)
+    {
+        return;
+    }
+    name = (NULL != name ? name : "");
+
+    static const char* kOP_NAMES[kOP_NUM] = { "put", "get", "peek", "get_size", "del", "peekv",
+        "consume" };
+    char buff[1024];
+    snprintf(buff, sizeof(buff), "kv_cache|%s|keys=%u/%u|blocks=%u/%u|data=%lu|alloc=%lu"
+        "|region=%lu|hit=%lu|miss=%lu|evict=%lu|expire=%lu|put=%lu|put_fail=%lu"
+        "|max_chain=%u|max_probe=%u\n", name,
+        info.key_num, info.max_key_num, info.block_num - info.free_block_num, info.block_num,
+        info.data_size, info.alloc_size, info.region_size, m_stats.hit_num, m_stats.miss_num,
+        m_stats.evict_num, m_stats.expire_num, m_stats.put_num, m_stats.put_fail_num,
+        info.max_chain_len, info.max_probe_len);
+    PLOG_STAT(buff);
+
+    std::string line("kv_cache_hist|");
+    line.append(name);
+    line.append("|chain=").append(FormatHist(info.chain_len_hist, kHIST_BUCKET_NUM, true));
+    line.append("|probe=").append(FormatHist(info.probe_len_hist, kHIST_BUCKET_NUM, false));
+    for (uint32_t op = 0; op < kOP_NUM && m_sample_interval > 0; ++op)
+    {
+        line.append("|").append(kOP_NAMES[op]).append("_ns=");
+        line.append(FormatHist(m_stats.latency_hist[op], kLATENCY_BUCKET_NUM, true));
+    }
+    line.append("\n");
+    PLOG_STAT(line.c_str());
+
+    for (uint32_t idx = 0; idx < m_meta->_class_num; ++idx)
+    {
+        const BlockClassMeta& cls = m_meta->_classes[idx];
+        snprintf(buff, sizeof(buff), "kv_cache_class|%s|block_size=%u|blocks=%u/%u|keys=%u"
+            "|data=%lu\n", name, cls._block_size, cls._block_num - cls._free_block_head._block_num,
+            cls._block_num, cls._key_num, cls._data_size);
+        PLOG_STAT(buff);
+    }
+}
+
+uint32_t KVCache::GetBlockClassStats(BlockClassStats* stats, uint32_t num) const
+{
+    if (NULL == stats || NULL == m_meta)
+    {
+        return 0;
+    }
+
+    num = std::min(num, m_meta->_class_num);
+    for (uint32_t idx = 0; idx < num; ++idx)
+    {
+        const BlockClassMeta& cls = m_meta->_classes[idx];
+        stats[idx].block_size = cls._block_size;
+        stats[idx].block_num = cls._block_num;
+        stats[idx].free_block_num = cls._free_block_head._block_num;
+        stats[idx].key_num = cls._key_num;
+        stats[idx].data_size = cls._data_size;
+    }
+    return num;
 }
 
 } // namespace pebble
@@ -15,23 +15,146 @@
 #ifndef _PEBBLE_KV_CACHE_H
 #define _PEBBLE_KV_CACHE_H
 
+#include <sys/uio.h>
+
 #include "common/platform.h"
 
 namespace pebble {
 
+class Timer;
+
 /// @brief 基于kv的本地buff
 class KVCache
 {
 public:
+    /// @brief 缓存满时的淘汰策略
+    enum EvictPolicy {
+        kEVICT_NONE = 0,    ///< 不淘汰，缓存满时写入失败
+        kEVICT_CLOCK,       ///< CLOCK近似LRU，淘汰最近未被访问的key
+    };
+
+    /// @brief 采样耗时的操作类型
+    enum OpType {
+        kOP_PUT = 0,
+        kOP_GET,
+        kOP_PEEK,
+        kOP_GET_SIZE,
+        kOP_DEL,
+        kOP_PEEKV,
+        kOP_CONSUME,
+        kOP_NUM
+    };
+
+    /// @brief 耗时分布的桶数，下标i表示耗时在[2^i, 2^(i+1))ns
+    static const uint32_t kLATENCY_BUCKET_NUM = 32;
+
+    /// @brief 缓存的运行统计，计数只在对应操作时累加
+    struct Stats
+    {
+        Stats() : hit_num(0), miss_num(0), evict_num(0), expire_num(0),
+            put_num(0), put_fail_num(0)
+        {
+            for (uint32_t op = 0; op < kOP_NUM; ++op)
+            {
+                for (uint32_t idx = 0; idx < kLATENCY_BUCKET_NUM; ++idx)
+                {
+                    latency_hist[op][idx] = 0;
+                }
+            }
+        }
+
+        /// @brief 累加另一份统计
+        void Add(const Stats& other);
+
+        uint64_t hit_num;       ///< Get/Peek/PeekV/Consume命中次数
+        uint64_t miss_num;      ///< Get/Peek/PeekV/Consume未命中次数
+        uint64_t evict_num;     ///< 被淘汰的key数
+        uint64_t expire_num;    ///< 过期被回收的key数
+        uint64_t put_num;       ///< Put次数
+        uint64_t put_fail_num;  ///< Put因块不足或key数达到上限失败的次数
+        /// 采样的操作耗时分布，需SetLatencySample开启
+        uint64_t latency_hist[kOP_NUM][kLATENCY_BUCKET_NUM];
+    };
+
+    /// @brief 分布统计的桶数
+    static const uint32_t kHIST_BUCKET_NUM = 16;
+
+    /// @brief 缓存的结构信息，由GetCacheInfo扫描索引得到
+    struct CacheInfo
+    {
+        uint32_t key_num;
+        uint32_t max_key_num;
+        uint32_t slot_num;
+        uint32_t block_num;
+        uint32_t free_block_num;
+        uint64_t data_size;         ///< 缓存的数据字节数
+        uint64_t alloc_size;        ///< 已分配块的字节数，data_size / alloc_size即块内存利用率
+        uint64_t region_size;       ///< 存储区(索引+块信息+块数据)总字节数
+        uint32_t max_chain_len;     ///< 最长的块链长度
+        uint32_t max_probe_len;     ///< 最长的探测距离
+        /// 块链长度分布，下标i表示长度在[2^i, 2^(i+1))
+        uint32_t chain_len_hist[kHIST_BUCKET_NUM];
+        /// 查找key需要的探测距离分布，下标i表示距离为i+1，最后一个桶包含更长的距离
+        uint32_t probe_len_hist[kHIST_BUCKET_NUM];
+    };
+
+    /// @brief 块大小级别的配置
+    struct BlockClass
+    {
+        uint32_t block_size;    ///< 块大小
+        uint32_t block_num;     ///< 块数
+    };
+
+    /// @brief 块大小级别的占用统计
+    struct BlockClassStats
+    {
+        uint32_t block_size;
+        uint32_t block_num;
+        uint32_t free_block_num;
+        uint32_t key_num;       ///< 使用该级别的key数
+        uint64_t data_size;     ///< 缓存的数据字节数，与(block_num - free_block_num) * block_size之比即内存利用率
+    };
+
+    /// @brief 最多支持的块大小级别数
+    static const uint32_t kMAX_BLOCK_CLASS_NUM = 8;
+    static const uint32_t kDEFAULT_BLOCK_NUM = 15000;
+    static const uint32_t kDEFAULT_BLOCK_SIZE = 512;
+
     KVCache();
     ~KVCache();
 
     /// @brief 初始化buff
-    /// @param max_frame_num 最大缓存的key数
-    /// @param total_mem_size 缓存的总内存大小
-    /// @param block_size 缓存的块大小
+    /// @param max_frame_num 最大缓存的key数，索引按此预分配，0表示与block_num相同
+    /// @param block_num 缓存的块数，0表示kDEFAULT_BLOCK_NUM
+    /// @param block_size 缓存的块大小，0表示kDEFAULT_BLOCK_SIZE
     int32_t Init(uint32_t max_frame_num, uint32_t block_num, uint32_t block_size);
 
+    /// @brief 使用多个块大小级别初始化buff，每个级别有独立的块池和空闲链表
+    /// @param max_frame_num 最大缓存的key数，0表示与总块数相同
+    /// @param classes 块大小级别，块大小不能重复，顺序不限
+    /// @param class_num 级别数，不超过kMAX_BLOCK_CLASS_NUM
+    /// @return 0 成功，<0 参数错误
+    /// @note 新key(包括覆盖写)按首次写入的长度选择能一块装下的最小级别，该级别空间不足时依次尝试
+    ///   更大、更小的级别；追加写沿用key已选的级别
+    int32_t Init(uint32_t max_frame_num, const BlockClass* classes, uint32_t class_num);
+
+    /// @brief 使用mmap文件初始化buff，索引、块信息、块数据都存放在文件映射的内存中，进程重启后可恢复
+    /// @param path 映射文件路径，使用/dev/shm下的文件即为共享内存
+    /// @param max_frame_num 最大缓存的key数，0表示与block_num相同
+    /// @param block_num 缓存的块数
+    /// @param block_size 缓存的块大小
+    /// @return 0 新建并初始化
+    /// @return 1 重新挂载已有文件，保留其中的缓存数据
+    /// @return <0 失败
+    /// @note 已有文件的参数不一致或校验失败时会重新初始化，原有数据丢失
+    /// @note 同一文件同一时刻只能被一个KVCache实例使用
+    int32_t InitShm(const char* path, uint32_t max_frame_num, uint32_t block_num, uint32_t block_size);
+
+    /// @brief 使用mmap文件及多个块大小级别初始化buff
+    /// @see Init InitShm
+    int32_t InitShm(const char* path, uint32_t max_frame_num, const BlockClass* classes,
+        uint32_t class_num);
+
     /// @brief 写入缓存
     /// @param key 写入缓存的键值
     /// @param buff 写入缓存的内容指针
@@ -55,6 +178,27 @@ public:
     /// @note 与Get不同，Peek不会删除缓存
     int32_t Peek(uint64_t key, char* buff, uint32_t length);
 
+    /// @brief 零拷贝窥视缓存，返回指向缓存内部存储块的数据段
+    /// @param key 窥视缓存的键值
+    /// @param iov 用于返回数据段(指针，长度)的数组
+    /// @param iov_num iov数组的长度，数据段数超过iov_num时只返回前iov_num段
+    /// @param length 最多窥视的数据长度
+    /// @return >=0 返回填充的数据段数，不存在是返回0
+    /// @note 返回的指针指向内部存储块，以下任一情况发生后失效，不能再访问：
+    ///   1. 对该key调用Get/MultiGet/Consume/Del/MultiDel或覆盖写
+    ///   2. 之后任意key的Put/MultiPut因空间不足淘汰了该key
+    ///   3. 该key过期，被之后的访问、ExpireScan或过期定时器回收
+    ///   4. 调用Restore
+    ///   追加写不影响已返回的数据段；需要跨越其他缓存操作持有数据时应使用Peek拷贝
+    /// @note 一般用法：PeekV后直接发送，再按发送成功的长度调用Consume释放
+    int32_t PeekV(uint64_t key, struct iovec* iov, uint32_t iov_num, uint32_t length = UINT32_MAX);
+
+    /// @brief 释放缓存头部的数据，与Get相同但不拷贝
+    /// @param key 缓存的键值
+    /// @param length 释放的数据长度
+    /// @return >=0 返回实际释放的数据长度，不存在是返回0
+    int32_t Consume(uint64_t key, uint32_t length);
+
     /// @brief 获取指定key的缓存数据长度
     /// @return 返回缓存的数据长度
     int32_t GetSize(uint64_t key);
@@ -63,31 +207,269 @@ public:
     /// @param key 缓存的键值
     int32_t Del(uint64_t key);
 
+    /// @brief 批量读出缓存，结果与依次调用Get相同
+    /// @param keys 读取缓存的键值数组
+    /// @param key_num 键值个数
+    /// @param buffs 每个key的读取buff(iov_base)及长度(iov_len)
+    /// @param results 返回每个key读取的数据长度，不存在为0，可为NULL
+    /// @return 命中的key数
+    /// @note 批量处理时提前预取后续key的索引槽位及块信息，隐藏大表的访存延迟
+    int32_t MultiGet(const uint64_t* keys, uint32_t key_num, const struct iovec* buffs,
+        int32_t* results);
+
+    /// @brief 批量写入缓存，结果与依次调用Put相同
+    /// @param keys 写入缓存的键值数组
+    /// @param key_num 键值个数
+    /// @param values 每个key写入的内容(iov_base)及长度(iov_len)
+    /// @param is_overwrite 是否覆盖写
+    /// @param results 返回每个key的Put返回值，可为NULL
+    /// @return 写入成功的key数
+    int32_t MultiPut(const uint64_t* keys, uint32_t key_num, const struct iovec* values,
+        bool is_overwrite, int32_t* results);
+
+    /// @brief 批量销毁缓存，结果与依次调用Del相同
+    /// @param results 返回每个key的Del返回值，可为NULL
+    /// @return 销毁的key数
+    int32_t MultiDel(const uint64_t* keys, uint32_t key_num, int32_t* results);
+
+    /// @brief 将缓存的所有未过期key及数据写入快照文件
+    /// @param path 快照文件路径，先写入path.tmp，完成后改名
+    /// @return >=0 写入的key数，<0 失败
+    /// @note 数据按块直接批量writev，不逐key调用系统调用
+    int32_t Snapshot(const char* path);
+
+    /// @brief 清空缓存并从快照文件恢复
+    /// @param path 快照文件路径
+    /// @return >=0 恢复的key数，<0 文件不存在或校验失败，此时缓存保持不变
+    /// @note 快照与当前缓存的配置可以不同，空间不足时放弃剩余的key；已过期的key不恢复
+    int32_t Restore(const char* path);
+
+    /// @brief 设置缓存满(块不足或key数达到上限)时的淘汰策略，默认不淘汰
+    void SetEvictPolicy(EvictPolicy policy) { m_evict_policy = policy; }
+
+    /// @brief 设置key的存活时间，过期后访问视为不存在
+    /// @param key 缓存的键值
+    /// @param ttl_ms 存活时间(ms)，0表示永不过期
+    /// @return 0 成功，-1 key不存在
+    /// @note 覆盖写或数据被读完后key被删除，需重新设置
+    int32_t SetTTL(uint64_t key, uint32_t ttl_ms);
+
+    /// @brief 增量扫描并回收过期的key，过期key访问时也会被回收，这里用于回收长期无访问的key
+    /// @param scan_num 本次最多扫描的槽位数
+    /// @return 本次回收的key数
+    int32_t ExpireScan(uint32_t scan_num);
+
+    /// @brief 使用定时器周期调用ExpireScan
+    /// @param timer 定时器，生命周期须长于KVCache
+    /// @param interval_ms 扫描周期(ms)
+    /// @param scan_num 每次最多扫描的槽位数
+    /// @return 0 成功，<0 启动定时器失败
+    int32_t StartExpireTimer(Timer* timer, uint32_t interval_ms, uint32_t scan_num);
+
+    /// @brief 获取运行统计
+    void GetStats(Stats* stats) const;
+
+    /// @brief 扫描索引获取缓存的结构信息
+    /// @return 0 成功，<0 未初始化
+    /// @note 耗时与槽位数成正比，用于周期性的统计上报，不要在热路径调用
+    int32_t GetCacheInfo(CacheInfo* info) const;
+
+    /// @brief 开启操作耗时采样，每sample_interval次操作采样一次，0表示关闭(默认)
+    void SetLatencySample(uint32_t sample_interval)
+    {
+        m_sample_interval = sample_interval;
+        m_sample_count = 0;
+    }
+
+    /// @brief 将运行统计、结构信息及各级别占用写入统计日志(PLOG_STAT)
+    /// @param name 缓存名，用于区分多个缓存
+    void WriteStatLog(const char* name);
+
+    /// @brief 获取各块大小级别的占用统计，按块大小升序
+    /// @param stats 统计数组
+    /// @param num 数组长度
+    /// @return 填充的级别数
+    uint32_t GetBlockClassStats(BlockClassStats* stats, uint32_t num) const;
+
 private:
+    class OpSampler;
+
     struct CacheBlockInfo
     {
-        uint16_t _write_pos;    ///< 当前block中写的位置
-        uint16_t _read_pos;     ///< 当前block中读的位置
+        uint32_t _write_pos;    ///< 当前block中写的位置
+        uint32_t _read_pos;     ///< 当前block中读的位置
         uint32_t _next_block;
     };
     struct CacheHeadInfo
     {
-        CacheHeadInfo() : _first_block(-1), _last_block(-1) {}
+        CacheHeadInfo() : _first_block(-1), _last_block(-1), _block_num(0), _data_size(0) {}
         uint32_t _first_block;
         uint32_t _last_block;
+        uint32_t _block_num;    ///< 链表中的块数
+        uint32_t _data_size;    ///< 链表中未读的数据长度，空闲链表不使用
     };
+    /// @brief 开放寻址(Robin Hood)索引的槽位
+    struct CacheSlot
+    {
+        uint64_t _key;
+        uint32_t _dist;         ///< 探测距离+1，0表示空槽
+        uint16_t _referenced;   ///< CLOCK访问位
+        uint16_t _class;        ///< 块大小级别，key的所有块属于同一级别
+        CacheHeadInfo _head;
+        int64_t _expire_time;   ///< 过期时间(ms)，0表示永不过期
+    };
+
+    /// @brief 查找key所在槽位
+    /// @return key所在的槽位，不存在返回NULL
+    CacheSlot* FindSlot(uint64_t key);
+
+    /// @brief 插入key，key已存在时返回已有槽位
+    /// @param inserted 返回是否新插入
+    /// @return key所在的槽位，索引已满返回NULL
+    CacheSlot* InsertSlot(uint64_t key, bool* inserted);
+
+    /// @brief 删除槽位，后续槽位向前移动，调用后槽位指针失效
+    void EraseSlot(CacheSlot* slot);
+
+    /// @brief 查找key所在槽位，key已过期时回收并返回NULL，命中时置访问位
+    CacheSlot* FindLiveSlot(uint64_t key);
+
+    /// @brief 从级别的空闲链表头部分配一个块
+    uint32_t AllocBlock(uint32_t class_idx);
+
+    /// @brief 将一个块归还级别的空闲链表尾部
+    void FreeBlock(uint32_t class_idx, uint32_t block_id);
+
+    /// @brief 将key的块链归还其级别的空闲链表
+    void FreeBlocks(uint32_t class_idx, const CacheHeadInfo& head);
+
+    /// @brief 为新插入的key设置级别并分配首块
+    void InitSlotBlocks(CacheSlot* slot, uint32_t class_idx);
+
+    /// @brief 追加数据到key的块链尾部，调用前须确认级别的空闲块足够
+    void WriteSlot(CacheSlot* slot, const char* buff, uint32_t length);
+
+    /// @brief 为新key选择块大小级别
+    uint32_t SelectClass(uint32_t length) const;
+
+    /// @brief 写入length字节需要的级别的块数
+    uint32_t CalcBlockNum(uint32_t class_idx, uint32_t length) const
+    {
+        uint32_t block_size = m_meta->_classes[class_idx]._block_size;
+        return length / block_size + ((length % block_size) == 0 ? 0 : 1);
+    }
+
+    char* BlockData(uint32_t class_idx, uint32_t block_id) const
+    {
+        const BlockClassMeta& cls = m_meta->_classes[class_idx];
+        return m_block_mem + cls._mem_offset
+            + static_cast<size_t>(block_id - cls._first_block) * cls._block_size;
+    }
+
+    /// @brief 回收key的块并删除槽位，调用后槽位指针失效
+    void DelSlot(CacheSlot* slot);
+
+    /// @brief 按CLOCK淘汰key，直到级别的空闲块数不少于need_free_block_num
+    /// @param class_idx 只淘汰该级别的key，kANY_CLASS表示不限级别
+    /// @param skip_key 不淘汰的key(正在写入的key)
+    /// @param max_evict_key_num 最多淘汰的key数
+    /// @return 淘汰的key数
+    uint32_t Evict(uint32_t class_idx, uint32_t need_free_block_num, uint64_t skip_key,
+        uint32_t max_evict_key_num);
+    static const uint32_t kANY_CLASS = UINT32_MAX;
+
+    int32_t OnExpireTimer(uint32_t scan_num);
+
+    /// @brief Get/Peek/Consume的实现
+    /// @param buff 为NULL时不拷贝数据
+    /// @param remove 是否释放读取的数据，读完时删除槽位
+    int32_t ReadSlot(CacheSlot* slot, char* buff, uint32_t length, bool remove);
+
+    uint32_t HashSlot(uint64_t key) const
+    {
+        return static_cast<uint32_t>((key * 0x9E3779B97F4A7C15ULL) >> m_slot_shift);
+    }
+
+    /// @brief 批量操作的预取：先预取远处key的槽位，槽位到达缓存后再预取其块信息和块数据
+    /// @param keys 批量操作的键值数组
+    /// @param key_num 键值个数
+    /// @param idx 当前处理的下标
+    /// @param tail 预取写入位置(链表尾块)还是读取位置(链表头块)
+    void PrefetchAhead(const uint64_t* keys, uint32_t key_num, uint32_t idx, bool tail);
+
+    /// @brief 块大小级别的元信息，各级别的块使用连续的全局下标
+    struct BlockClassMeta
+    {
+        uint32_t _block_size;
+        uint32_t _block_num;
+        uint32_t _first_block;          ///< 该级别第一个块的全局下标
+        CacheHeadInfo _free_block_head; ///< 空闲的存储块链表
+        uint32_t _key_num;              ///< 使用该级别的key数
+        uint64_t _data_size;            ///< 缓存的数据字节数
+        uint64_t _mem_offset;           ///< 该级别的块数据在块数据区中的偏移
+    };
+
+    /// @brief 缓存的元信息及可变状态，位于存储区头部，存储区内只使用下标，与映射地址无关
+    struct CacheMeta
+    {
+        uint64_t _magic;
+        uint32_t _version;
+        uint32_t _block_num;            ///< 所有级别的总块数
+        uint32_t _class_num;
+        uint32_t _slot_num;
+        uint32_t _max_key_num;          ///< 最大key数，控制装载率
+        uint32_t _key_num;              ///< 当前缓存的key数
+        BlockClassMeta _classes[kMAX_BLOCK_CLASS_NUM]; ///< 按块大小升序
+        uint64_t _region_size;          ///< 存储区总大小
+    };
+
+    /// @brief 计算存储区参数，填充meta中的配置部分
+    /// @return 0 成功，<0 参数错误
+    int32_t SetupMeta(uint32_t max_frame_num, const BlockClass* classes, uint32_t class_num,
+        CacheMeta* meta);
+
+    /// @brief 两个meta的配置(存储区布局)是否一致
+    static bool SameLayout(const CacheMeta& lhs, const CacheMeta& rhs);
+
+    /// @brief 按meta计算各部分在存储区中的偏移，返回存储区总大小
+    static size_t CalcLayout(const CacheMeta& meta, size_t* slot_offset, size_t* info_offset,
+        size_t* mem_offset);
+
+    /// @brief 设置存储区，各指针按偏移指向存储区内
+    void BindRegion(char* region);
+
+    /// @brief 清空索引，所有block放入空闲链表
+    void ResetData();
+
+    /// @brief 校验存储区的结构完整性(挂载已有文件时使用)
+    bool Validate();
+
+    void Release();
 
     uint32_t m_block_num;
-    uint32_t m_block_size;
-    uint32_t m_free_block_size;         ///< 空闲的存储块数量
-    CacheHeadInfo m_free_block_head;    ///< 空闲的存储块头
+    uint32_t m_block_size;  ///< 单级别初始化时的默认块大小
 
+    CacheMeta*          m_meta;         ///< 元信息，位于存储区头部
     CacheBlockInfo*     m_block_infos;  ///< 存储块的信息
     char*               m_block_mem;    ///< 存储块的数据
 
-    typedef cxx::unordered_map<uint64_t, CacheHeadInfo> CacheMap;
-    typedef std::pair<uint64_t, CacheHeadInfo> CacheMapPair;
-    CacheMap            m_caches;
+    // 访问非常频繁，使用预分配的开放寻址表，插入不分配内存，查找只访问连续的少数槽位
+    CacheSlot*          m_slots;        ///< 索引槽位，个数为2的幂
+    uint32_t            m_slot_mask;
+    uint32_t            m_slot_shift;   ///< 64 - log2(槽位数)，取hash高位
+
+    char*               m_region;       ///< 存储区，元信息、索引、块信息、块数据连续存放
+    size_t              m_region_size;
+    bool                m_is_mmap;      ///< 存储区是否为文件映射
+
+    EvictPolicy         m_evict_policy;
+    uint32_t            m_clock_hand;   ///< CLOCK指针，槽位下标
+    uint32_t            m_expire_cursor;///< 过期扫描的槽位下标
+    Timer*              m_expire_timer;
+    int64_t             m_expire_timer_id;
+    Stats               m_stats;
+    uint32_t            m_sample_interval;  ///< 耗时采样间隔，0表示不采样
+    uint32_t            m_sample_count;
 };
 
 } // namespace pebble
@@ -0,0 +1,93 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#ifndef _PEBBLE_COMMON_LATCH_H_
+#define _PEBBLE_COMMON_LATCH_H_
+
+#include <limits.h>
+#include <stdint.h>
+
+#include "common/futex.h"
+#include "common/time_utility.h"
+
+namespace pebble {
+
+
+/// @brief 计数门闩，计数减为0时唤醒所有等待者
+///   计数在未归零前可以继续增加，用于等待数量事先未知的一组任务
+/// @note 计数归零后CountDown仍会访问Latch，调用者需保证此时Latch未被释放
+class Latch
+{
+public:
+    explicit Latch(int32_t count = 0) : m_count(count) {}
+
+    /// @brief 增加计数，只能在计数未归零时调用
+    void Add(int32_t num = 1)
+    {
+        __atomic_add_fetch(&m_count, num, __ATOMIC_RELAXED);
+    }
+
+    /// @brief 计数减1，归零时唤醒所有等待者
+    void CountDown()
+    {
+        if (__atomic_sub_fetch(&m_count, 1, __ATOMIC_ACQ_REL) == 0)
+        {
+            FutexWake(&m_count, INT_MAX);
+        }
+    }
+
+    /// @return true 计数已归零
+    bool TryWait() const
+    {
+        return __atomic_load_n(&m_count, __ATOMIC_ACQUIRE) == 0;
+    }
+
+    /// @brief 等待计数归零
+    void Wait()
+    {
+        int32_t count = 0;
+        while ((count = __atomic_load_n(&m_count, __ATOMIC_ACQUIRE)) != 0)
+        {
+            FutexWait(&m_count, count);
+        }
+    }
+
+    /// @brief 等待计数归零
+    /// @return true 已归零，false 超时
+    bool WaitFor(int32_t timeout_ms)
+    {
+        int64_t deadline = TimeUtility::GetCurrentMS() + timeout_ms;
+        int32_t count = 0;
+        while ((count = __atomic_load_n(&m_count, __ATOMIC_ACQUIRE)) != 0)
+        {
+            int64_t remain = deadline - TimeUtility::GetCurrentMS();
+            if (remain <= 0)
+            {
+                return false;
+            }
+            FutexWait(&m_count, count, static_cast<int>(remain));
+        }
+        return true;
+    }
+
+private:
+    Latch(const Latch&);
+    Latch& operator=(const Latch&);
+
+    int32_t m_count;
+};
+
+} // namespace pebble
+
+#endif // _PEBBLE_COMMON_LATCH_H_
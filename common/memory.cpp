@@ -35,22 +35,24 @@ int GetCurMemoryUsage(int* vm_size_kb, int* rss_size_kb) {
         return -1;
     }
 
-    int ret = 0;
+    // 新内核的status字段较多，VmSize/VmRSS的行号不固定，读到两者都找到为止
+    int ret = -2;
+    int found = 0;
     char line[256] = { 0 };
     char tmp[32]   = { 0 };
     fseek(pid_status, 0, SEEK_SET);
-    for (int i = 0; i < 16; i++) {
-        if (fgets(line, sizeof(line), pid_status) == NULL) {
-            ret = -2;
-            break;
-        }
-
+    while (found < 2 && fgets(line, sizeof(line), pid_status) != NULL) {
         if (strstr(line, "VmSize") != NULL) {
             sscanf(line, "%s %d", tmp, vm_size_kb);
+            found++;
         } else if (strstr(line, "VmRSS") != NULL) {
             sscanf(line, "%s %d", tmp, rss_size_kb);
+            found++;
         }
     }
+    if (found == 2) {
+        ret = 0;
+    }
 
     fclose(pid_status);
 
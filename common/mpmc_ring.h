@@ -0,0 +1,304 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#ifndef _PEBBLE_COMMON_MPMC_RING_H_
+#define _PEBBLE_COMMON_MPMC_RING_H_
+
+#include <sched.h>
+#include <stdint.h>
+#include <cstddef>
+
+#include "common/futex.h"
+#include "common/platform.h"
+#include "common/time_utility.h"
+
+namespace pebble {
+
+
+/// @brief 无锁有界多生产者多消费者环形队列(Vyukov)，FIFO
+///   每个槽位带序号，生产者和消费者各自CAS推进位置，不加锁
+///   接口与BlockingQueue的PushBack/PopFront系列相同，可直接替换
+///   阻塞接口只在队列满/空时通过futex睡眠，有等待者时才会唤醒
+template <typename T>
+class MpmcRing
+{
+public:
+    typedef T ValueType;
+
+    /// @param capacity 容量，向上取整为2的幂
+    explicit MpmcRing(size_t capacity = 4096)
+        : m_enqueue_pos(0), m_dequeue_pos(0),
+          m_not_empty_seq(0), m_pop_waiters(0), m_not_full_seq(0), m_push_waiters(0)
+    {
+        size_t size = 2;
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+        m_mask = size - 1;
+        m_cells = new Cell[size];
+        for (size_t i = 0; i < size; ++i)
+        {
+            m_cells[i].seq = i;
+        }
+    }
+
+    ~MpmcRing()
+    {
+        delete [] m_cells;
+    }
+
+    /// @brief try push element in to back of queue
+    /// @param value to be pushed
+    /// @note if queue is full, return false
+    bool TryPushBack(const T& value)
+    {
+        Cell* cell = NULL;
+        size_t pos = __atomic_load_n(&m_enqueue_pos, __ATOMIC_RELAXED);
+        while (true)
+        {
+            cell = &m_cells[pos & m_mask];
+            size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (0 == diff)
+            {
+                if (__atomic_compare_exchange_n(&m_enqueue_pos, &pos, pos + 1, true,
+                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = __atomic_load_n(&m_enqueue_pos, __ATOMIC_RELAXED);
+            }
+        }
+
+        cell->value = value;
+        __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+        Notify(&m_not_empty_seq, &m_pop_waiters);
+        return true;
+    }
+
+    /// @brief push element in to back of queue
+    /// @param value to be pushed
+    /// @note if queue is full, block and wait for non-full
+    void PushBack(const T& value)
+    {
+        while (!TimedPushBack(value, -1))
+        {
+        }
+    }
+
+    /// @brief push element in to back of queue, with timeout
+    /// @param value to be pushed
+    /// @param timeout_in_ms timeout(ms)，<0 wait forever
+    /// @return whether pushed
+    bool TimedPushBack(const T& value, int timeout_in_ms)
+    {
+        int64_t deadline = Deadline(timeout_in_ms);
+        while (!TryPushBack(value))
+        {
+            if (!Park(&m_not_full_seq, &m_push_waiters, deadline, true))
+            {
+                return TryPushBack(value);
+            }
+        }
+        return true;
+    }
+
+    /// @brief Try popup from front of queue
+    /// @param value to hold the result
+    /// @note if queue is empty, return false
+    bool TryPopFront(T* value)
+    {
+        Cell* cell = NULL;
+        size_t pos = __atomic_load_n(&m_dequeue_pos, __ATOMIC_RELAXED);
+        while (true)
+        {
+            cell = &m_cells[pos & m_mask];
+            size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (0 == diff)
+            {
+                if (__atomic_compare_exchange_n(&m_dequeue_pos, &pos, pos + 1, true,
+                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = __atomic_load_n(&m_dequeue_pos, __ATOMIC_RELAXED);
+            }
+        }
+
+        *value = cell->value;
+        cell->value = T();
+        __atomic_store_n(&cell->seq, pos + m_mask + 1, __ATOMIC_RELEASE);
+        Notify(&m_not_full_seq, &m_push_waiters);
+        return true;
+    }
+
+    /// @brief popup from front of queue.
+    /// @param value to hold the result
+    /// @note if queue is empty, block and wait for non-empty
+    void PopFront(T* value)
+    {
+        while (!TimedPopFront(value, -1))
+        {
+        }
+    }
+
+    /// @brief popup from front of queue, with timeout
+    /// @param value to hold the result
+    /// @param timeout_in_ms timeout(ms)，<0 wait forever
+    /// @return whether popped
+    bool TimedPopFront(T* value, int timeout_in_ms)
+    {
+        int64_t deadline = Deadline(timeout_in_ms);
+        while (!TryPopFront(value))
+        {
+            if (!Park(&m_not_empty_seq, &m_pop_waiters, deadline, false))
+            {
+                return TryPopFront(value);
+            }
+        }
+        return true;
+    }
+
+    /// @brief approximate number of elements
+    size_t Size() const
+    {
+        size_t dequeue_pos = __atomic_load_n(&m_dequeue_pos, __ATOMIC_ACQUIRE);
+        size_t enqueue_pos = __atomic_load_n(&m_enqueue_pos, __ATOMIC_ACQUIRE);
+        return enqueue_pos > dequeue_pos ? enqueue_pos - dequeue_pos : 0;
+    }
+
+    size_t Capacity() const
+    {
+        return m_mask + 1;
+    }
+
+    bool IsEmpty() const
+    {
+        return Size() == 0;
+    }
+
+    bool IsFull() const
+    {
+        return Size() >= Capacity();
+    }
+
+    /// @brief pop and drop all elements
+    void Clear()
+    {
+        T value;
+        while (TryPopFront(&value))
+        {
+        }
+    }
+
+private:
+    MpmcRing(const MpmcRing&);
+    MpmcRing& operator=(const MpmcRing&);
+
+    static const int32_t kYIELD_NUM = 16;
+
+    struct Cell
+    {
+        size_t seq;
+        T value;
+    };
+
+    static int64_t Deadline(int timeout_in_ms)
+    {
+        return timeout_in_ms < 0 ? -1 : TimeUtility::GetCurrentMS() + timeout_in_ms;
+    }
+
+    /// @brief 有等待者时递增序号并唤醒一个
+    static void Notify(int32_t* seq, int32_t* waiters)
+    {
+        // 与Park中先登记等待者再检查队列配对，保证不会丢失唤醒
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(waiters, __ATOMIC_RELAXED) > 0)
+        {
+            __atomic_add_fetch(seq, 1, __ATOMIC_RELEASE);
+            FutexWake(seq, 1);
+        }
+    }
+
+    /// @brief 等待队列状态变化
+    /// @param for_push 等待非满(true)还是非空(false)
+    /// @return false 已超时
+    bool Park(int32_t* seq, int32_t* waiters, int64_t deadline, bool for_push)
+    {
+        // 短暂让出CPU，对端通常很快就会推进，避免每个元素都进出一次futex
+        for (int32_t i = 0; i < kYIELD_NUM; ++i)
+        {
+            if (!(for_push ? IsFull() : IsEmpty()))
+            {
+                return true;
+            }
+            sched_yield();
+        }
+
+        int timeout = -1;
+        if (deadline >= 0)
+        {
+            int64_t now = TimeUtility::GetCurrentMS();
+            if (now >= deadline)
+            {
+                return false;
+            }
+            timeout = static_cast<int>(deadline - now);
+        }
+
+        __atomic_add_fetch(waiters, 1, __ATOMIC_SEQ_CST);
+        int32_t cur_seq = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        // 登记后再确认一次，期间的状态变化会修改序号使FutexWait立即返回
+        if (for_push ? IsFull() : IsEmpty())
+        {
+            FutexWait(seq, cur_seq, timeout);
+        }
+        __atomic_sub_fetch(waiters, 1, __ATOMIC_SEQ_CST);
+        return true;
+    }
+
+    size_t m_enqueue_pos;
+    char m_pad1[PEBBLE_CACHELINE_SIZE - sizeof(size_t)];
+    size_t m_dequeue_pos;
+    char m_pad2[PEBBLE_CACHELINE_SIZE - sizeof(size_t)];
+    int32_t m_not_empty_seq;
+    int32_t m_pop_waiters;
+    char m_pad3[PEBBLE_CACHELINE_SIZE - sizeof(int32_t) * 2];
+    int32_t m_not_full_seq;
+    int32_t m_push_waiters;
+    char m_pad4[PEBBLE_CACHELINE_SIZE - sizeof(int32_t) * 2];
+    Cell* m_cells;
+    size_t m_mask;
+};
+
+} // namespace pebble
+
+#endif // _PEBBLE_COMMON_MPMC_RING_H_
@@ -0,0 +1,107 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#ifndef _PEBBLE_COMMON_MPSC_QUEUE_H_
+#define _PEBBLE_COMMON_MPSC_QUEUE_H_
+
+#include <cstddef>
+
+#include "common/platform.h"
+
+namespace pebble {
+
+
+/// @brief 无锁多生产者单消费者队列(Vyukov)，无界，FIFO
+///   Push可在任意线程调用，wait-free；TryPop/IsEmpty只能在唯一的消费者线程调用
+/// @note 每次Push分配一个节点，适合跨线程的低频控制消息，不适合大流量数据
+template <typename T>
+class MpscQueue
+{
+public:
+    typedef T ValueType;
+
+    MpscQueue()
+    {
+        Node* stub = new Node;
+        stub->next = NULL;
+        m_head = stub;
+        m_tail = stub;
+    }
+
+    ~MpscQueue()
+    {
+        while (m_tail != NULL)
+        {
+            Node* next = m_tail->next;
+            delete m_tail;
+            m_tail = next;
+        }
+    }
+
+    /// @brief push element in to back of queue
+    /// @param value to be pushed
+    void Push(const T& value)
+    {
+        Node* node = new Node;
+        node->value = value;
+        node->next = NULL;
+        Node* prev = __atomic_exchange_n(&m_head, node, __ATOMIC_ACQ_REL);
+        // prev与node之间短暂断开，此时消费者看到的队列为空，不影响正确性
+        __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+    }
+
+    /// @brief Try popup from front of queue, consumer thread only
+    /// @param value to hold the result
+    /// @note if queue is empty, return false
+    bool TryPop(T* value)
+    {
+        Node* tail = m_tail;
+        Node* next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+        if (NULL == next)
+        {
+            return false;
+        }
+        // next成为新的stub节点，其value已被取走
+        *value = next->value;
+        next->value = T();
+        m_tail = next;
+        delete tail;
+        return true;
+    }
+
+    /// @brief whether the queue is empty, consumer thread only
+    /// @return whether empty
+    bool IsEmpty() const
+    {
+        return NULL == __atomic_load_n(&m_tail->next, __ATOMIC_ACQUIRE);
+    }
+
+private:
+    MpscQueue(const MpscQueue&);
+    MpscQueue& operator=(const MpscQueue&);
+
+    struct Node
+    {
+        Node* next;
+        T value;
+    };
+
+    Node* m_head;   ///< 生产者端
+    char m_pad[PEBBLE_CACHELINE_SIZE - sizeof(Node*)];
+    Node* m_tail;   ///< 消费者端
+};
+
+} // namespace pebble
+
+#endif // _PEBBLE_COMMON_MPSC_QUEUE_H_
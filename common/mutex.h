@@ -43,6 +43,12 @@ public:
         pthread_mutex_unlock(&m_mutex);
     }
 
+    /// @return true 加锁成功，false 已被其他线程锁住
+    bool TryLock()
+    {
+        return pthread_mutex_trylock(&m_mutex) == 0;
+    }
+
     pthread_mutex_t* GetMutex() {
         return &m_mutex;
     }
@@ -0,0 +1,367 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#ifndef _PEBBLE_COMMON_PARALLEL_H_
+#define _PEBBLE_COMMON_PARALLEL_H_
+
+#include <stdint.h>
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <vector>
+
+#include "common/latch.h"
+#include "common/mutex.h"
+#include "common/platform.h"
+#include "common/thread_pool.h"
+
+/*
+    基于ThreadPool的并行算法：ParallelFor、ParallelReduce、ParallelSort
+    1、区间递归二分，每次拆出的右半部分作为一个任务提交，直到不大于grain，任务数约为区间长度/grain。
+    2、调用线程执行左半部分，完成后继续执行还没有被线程池取走的部分，最后在Latch上等待。
+    3、线程池拒绝任务(如NO_PENDING模式下线程全忙)时在当前线程执行，结果不受影响。
+    4、可以在线程池的任务中调用，等待期间只执行本次调用拆分出的任务。
+*/
+
+namespace pebble {
+
+
+/// @brief 没有结果的并行任务的结果类型
+struct ParallelNone {};
+
+/// @brief 一次并行调用的共享状态，引用计数管理，调用线程和每个已提交的任务各持有一个引用
+/// @note Body需要定义ValueType，以及const的operator()(int64_t begin, int64_t end, ValueType* value)
+template <typename Body>
+class ParallelJob
+{
+public:
+    typedef typename Body::ValueType ValueType;
+
+    /// @brief 拆分出的一段区间，执行前需要先认领，保证只执行一次
+    struct Piece
+    {
+        int64_t begin;
+        int64_t end;
+        int32_t claimed;
+        ValueType value;
+    };
+
+    ParallelJob(ThreadPool* pool, const Body& body, int64_t grain)
+        : m_pool(pool), m_body(body), m_grain(grain > 0 ? grain : 1), m_ref_num(1) {}
+
+    /// @brief 在调用线程执行[begin, end)并等待全部完成，只能调用一次
+    void Run(int64_t begin, int64_t end)
+    {
+        Piece* piece = AddPiece(begin, end);
+        piece->claimed = 1;
+        Execute(piece);
+
+        size_t cursor = 0;
+        while ((piece = NextUnclaimed(&cursor)) != NULL)
+        {
+            Execute(piece);
+        }
+        m_latch.Wait();
+    }
+
+    /// @brief 按区间顺序获取各段，Run返回后调用
+    void GetPieces(std::vector<Piece*>* pieces)
+    {
+        *pieces = m_pieces;
+        std::sort(pieces->begin(), pieces->end(), LessPiece);
+    }
+
+    void Release()
+    {
+        if (__atomic_sub_fetch(&m_ref_num, 1, __ATOMIC_ACQ_REL) == 0)
+        {
+            delete this;
+        }
+    }
+
+private:
+    ~ParallelJob()
+    {
+        for (size_t i = 0; i < m_pieces.size(); ++i)
+        {
+            delete m_pieces[i];
+        }
+    }
+
+    static bool LessPiece(const Piece* left, const Piece* right)
+    {
+        return left->begin < right->begin;
+    }
+
+    static void RunPiece(ParallelJob* job, Piece* piece)
+    {
+        if (job->Claim(piece))
+        {
+            job->Execute(piece);
+        }
+        job->Release();
+    }
+
+    bool Claim(Piece* piece)
+    {
+        return __atomic_load_n(&piece->claimed, __ATOMIC_RELAXED) == 0
+            && __atomic_exchange_n(&piece->claimed, 1, __ATOMIC_ACQ_REL) == 0;
+    }
+
+    Piece* AddPiece(int64_t begin, int64_t end)
+    {
+        Piece* piece = new Piece;
+        piece->begin = begin;
+        piece->end = end;
+        piece->claimed = 0;
+        piece->value = ValueType();
+        m_latch.Add(1);
+        AutoLocker locker(&m_mutex);
+        m_pieces.push_back(piece);
+        return piece;
+    }
+
+    Piece* NextUnclaimed(size_t* cursor)
+    {
+        AutoLocker locker(&m_mutex);
+        while (*cursor < m_pieces.size())
+        {
+            Piece* piece = m_pieces[(*cursor)++];
+            if (Claim(piece))
+            {
+                return piece;
+            }
+        }
+        return NULL;
+    }
+
+    bool Submit(Piece* piece)
+    {
+        if (m_pool == NULL)
+        {
+            return false;
+        }
+        __atomic_add_fetch(&m_ref_num, 1, __ATOMIC_RELAXED);
+        cxx::function<void()> task = cxx::bind(&ParallelJob::RunPiece, this, piece);
+        if (m_pool->AddTask(task) != 0)
+        {
+            Release();
+            return false;
+        }
+        return true;
+    }
+
+    // 不断拆出右半部分提交，剩下的不大于grain时执行
+    void Execute(Piece* piece)
+    {
+        while (piece->end - piece->begin > m_grain)
+        {
+            int64_t mid = piece->begin + (piece->end - piece->begin) / 2;
+            Piece* right = AddPiece(mid, piece->end);
+            piece->end = mid;
+            if (!Submit(right) && Claim(right))
+            {
+                Execute(right);
+            }
+        }
+        m_body(piece->begin, piece->end, &piece->value);
+        m_latch.CountDown();
+    }
+
+    ThreadPool* m_pool;
+    Body m_body;
+    int64_t m_grain;
+    int32_t m_ref_num;
+    Latch m_latch;          // 未完成的段数
+    Mutex m_mutex;
+    std::vector<Piece*> m_pieces;
+};
+
+template <typename Fun>
+class ParallelForBody
+{
+public:
+    typedef ParallelNone ValueType;
+
+    explicit ParallelForBody(const Fun& fun) : m_fun(fun) {}
+
+    void operator()(int64_t begin, int64_t end, ValueType* /* value */) const
+    {
+        for (int64_t i = begin; i < end; ++i)
+        {
+            m_fun(i);
+        }
+    }
+
+private:
+    Fun m_fun;
+};
+
+template <typename T, typename MapFun, typename ReduceFun>
+class ParallelReduceBody
+{
+public:
+    typedef T ValueType;
+
+    ParallelReduceBody(const T& identity, const MapFun& map, const ReduceFun& reduce)
+        : m_identity(identity), m_map(map), m_reduce(reduce) {}
+
+    void operator()(int64_t begin, int64_t end, ValueType* value) const
+    {
+        T result = m_identity;
+        for (int64_t i = begin; i < end; ++i)
+        {
+            result = m_reduce(result, m_map(i));
+        }
+        *value = result;
+    }
+
+private:
+    T m_identity;
+    MapFun m_map;
+    ReduceFun m_reduce;
+};
+
+/// @brief 对[begin, end)中的每个i并行执行fun(i)，全部完成后返回
+/// @param pool 执行拆分任务的线程池，为NULL时在当前线程顺序执行
+/// @param grain 每个任务最少处理的元素个数，应使单个任务的耗时远大于提交任务的开销(约1us)
+/// @param fun 可被多个线程同时调用的函数或函数对象，参数为int64_t
+template <typename Fun>
+void ParallelFor(ThreadPool* pool, int64_t begin, int64_t end, int64_t grain, Fun fun)
+{
+    if (begin >= end)
+    {
+        return;
+    }
+    ParallelJob<ParallelForBody<Fun> >* job =
+        new ParallelJob<ParallelForBody<Fun> >(pool, ParallelForBody<Fun>(fun), grain);
+    job->Run(begin, end);
+    job->Release();
+}
+
+/// @brief 并行计算reduce(...reduce(reduce(identity, map(begin)), map(begin + 1))..., map(end - 1))
+/// @param identity reduce的单位元，每个任务以它为初值
+/// @param map 参数为int64_t，返回T
+/// @param reduce 参数为两个T，返回T，需满足结合律；各任务的结果按区间顺序合并，不要求交换律
+/// @return 计算结果，区间为空时返回identity
+template <typename T, typename MapFun, typename ReduceFun>
+T ParallelReduce(ThreadPool* pool, int64_t begin, int64_t end, int64_t grain,
+    const T& identity, MapFun map, ReduceFun reduce)
+{
+    if (begin >= end)
+    {
+        return identity;
+    }
+    typedef ParallelReduceBody<T, MapFun, ReduceFun> Body;
+    typedef ParallelJob<Body> Job;
+    Job* job = new Job(pool, Body(identity, map, reduce), grain);
+    job->Run(begin, end);
+
+    std::vector<typename Job::Piece*> pieces;
+    job->GetPieces(&pieces);
+    T result = identity;
+    for (size_t i = 0; i < pieces.size(); ++i)
+    {
+        result = reduce(result, pieces[i]->value);
+    }
+    job->Release();
+    return result;
+}
+
+template <typename RandomIt, typename Compare>
+class ParallelSortChunk
+{
+public:
+    ParallelSortChunk(RandomIt first, int64_t size, int64_t width, Compare comp)
+        : m_first(first), m_size(size), m_width(width), m_comp(comp) {}
+
+    void operator()(int64_t index) const
+    {
+        int64_t begin = index * m_width;
+        int64_t end = std::min(begin + m_width, m_size);
+        std::sort(m_first + begin, m_first + end, m_comp);
+    }
+
+private:
+    RandomIt m_first;
+    int64_t m_size;
+    int64_t m_width;
+    Compare m_comp;
+};
+
+template <typename RandomIt, typename Compare>
+class ParallelMergeChunk
+{
+public:
+    ParallelMergeChunk(RandomIt first, int64_t size, int64_t width, Compare comp)
+        : m_first(first), m_size(size), m_width(width), m_comp(comp) {}
+
+    void operator()(int64_t index) const
+    {
+        int64_t begin = index * m_width * 2;
+        int64_t mid = std::min(begin + m_width, m_size);
+        int64_t end = std::min(begin + m_width * 2, m_size);
+        if (mid < end)
+        {
+            std::inplace_merge(m_first + begin, m_first + mid, m_first + end, m_comp);
+        }
+    }
+
+private:
+    RandomIt m_first;
+    int64_t m_size;
+    int64_t m_width;
+    Compare m_comp;
+};
+
+/// @brief 并行排序，不稳定
+///   先把区间分成长度为grain的块并行std::sort，再逐轮两两并行归并
+/// @param grain 块长度，越小并行度越高，但归并轮数越多；最后一轮归并只能由一个线程完成
+template <typename RandomIt, typename Compare>
+void ParallelSort(ThreadPool* pool, RandomIt first, RandomIt last, Compare comp,
+    int64_t grain = 16384)
+{
+    int64_t size = last - first;
+    if (grain <= 0)
+    {
+        grain = 1;
+    }
+    if (size <= grain)
+    {
+        std::sort(first, last, comp);
+        return;
+    }
+
+    int64_t chunk_num = (size + grain - 1) / grain;
+    ParallelFor(pool, 0, chunk_num, 1,
+        ParallelSortChunk<RandomIt, Compare>(first, size, grain, comp));
+    for (int64_t width = grain; width < size; width *= 2)
+    {
+        int64_t merge_num = (size + width * 2 - 1) / (width * 2);
+        ParallelFor(pool, 0, merge_num, 1,
+            ParallelMergeChunk<RandomIt, Compare>(first, size, width, comp));
+    }
+}
+
+/// @brief 按operator<并行排序，指定grain时请使用带comp的版本
+template <typename RandomIt>
+void ParallelSort(ThreadPool* pool, RandomIt first, RandomIt last)
+{
+    typedef typename std::iterator_traits<RandomIt>::value_type ValueType;
+    ParallelSort(pool, first, last, std::less<ValueType>());
+}
+
+} // namespace pebble
+
+#endif // _PEBBLE_COMMON_PARALLEL_H_
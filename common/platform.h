@@ -78,6 +78,11 @@
 #define  UINT64_MAX  0xffffffffffffffffULL
 #endif
 
+// 缓存行大小，用于多线程共享数据的对齐和填充，避免伪共享
+#ifndef PEBBLE_CACHELINE_SIZE
+#define PEBBLE_CACHELINE_SIZE 64
+#endif
+
 namespace pebble {
 namespace stdcxx {
 
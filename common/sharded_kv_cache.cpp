@@ -0,0 +1,249 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#include <stdlib.h>
+#include <algorithm>
+#include <new>
+
+#include "sharded_kv_cache.h"
+
+namespace pebble {
+
+
+ShardedKVCache::ShardedKVCache()
+    :   m_shards(NULL), m_shard_mask(0)
+{
+}
+
+ShardedKVCache::~ShardedKVCache()
+{
+    FreeShards();
+}
+
+uint32_t ShardedKVCache::AllocShards(uint32_t shard_num)
+{
+    if (NULL != m_shards || 0 == shard_num)
+    {
+        return 0;
+    }
+
+    uint32_t num = 1;
+    while (num < shard_num)
+    {
+        num <<= 1;
+    }
+
+    // new[]不保证超过默认对齐的对齐要求
+    void* mem = NULL;
+    if (posix_memalign(&mem, PEBBLE_CACHELINE_SIZE, sizeof(Shard) * num) != 0)
+    {
+        return 0;
+    }
+    m_shards = static_cast<Shard*>(mem);
+    m_shard_mask = num - 1;
+    for (uint32_t idx = 0; idx < num; ++idx)
+    {
+        new (m_shards + idx) Shard();
+    }
+    return num;
+}
+
+void ShardedKVCache::FreeShards()
+{
+    if (NULL != m_shards)
+    {
+        for (uint32_t idx = 0; idx <= m_shard_mask; ++idx)
+        {
+            m_shards[idx].~Shard();
+        }
+        free(m_shards);
+        m_shards = NULL;
+    }
+    m_shard_mask = 0;
+}
+
+int32_t ShardedKVCache::Init(uint32_t shard_num, uint32_t max_frame_num, uint32_t block_num,
+    uint32_t block_size)
+{
+    // 与KVCache::Init相同，0表示使用默认值
+    KVCache::BlockClass cls;
+    cls.block_size = block_size;
+    cls.block_num = block_num;
+    if (0 == cls.block_size)
+    {
+        cls.block_size = KVCache::kDEFAULT_BLOCK_SIZE;
+    }
+    if (0 == cls.block_num)
+    {
+        cls.block_num = KVCache::kDEFAULT_BLOCK_NUM;
+    }
+    return Init(shard_num, max_frame_num, &cls, 1);
+}
+
+int32_t ShardedKVCache::Init(uint32_t shard_num, uint32_t max_frame_num,
+    const KVCache::BlockClass* classes, uint32_t class_num)
+{
+    if (NULL == classes || 0 == class_num || class_num > KVCache::kMAX_BLOCK_CLASS_NUM)
+    {
+        return -1;
+    }
+    uint32_t num = AllocShards(shard_num);
+    if (0 == num)
+    {
+        return -1;
+    }
+
+    KVCache::BlockClass shard_classes[KVCache::kMAX_BLOCK_CLASS_NUM];
+    for (uint32_t idx = 0; idx < class_num; ++idx)
+    {
+        shard_classes[idx].block_size = classes[idx].block_size;
+        shard_classes[idx].block_num = (classes[idx].block_num + num - 1) / num;
+    }
+    uint32_t shard_frame_num = (max_frame_num + num - 1) / num;
+    for (uint32_t idx = 0; idx < num; ++idx)
+    {
+        if (m_shards[idx].cache.Init(shard_frame_num, shard_classes, class_num) != 0)
+        {
+            // 释放已初始化的分片，允许重新Init
+            FreeShards();
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int32_t ShardedKVCache::Put(uint64_t key, const char* buff, uint32_t length, bool is_overwrite)
+{
+    Shard* shard = GetShard(key);
+    AutoLocker locker(&shard->lock);
+    return shard->cache.Put(key, buff, length, is_overwrite);
+}
+
+int32_t ShardedKVCache::Get(uint64_t key, char* buff, uint32_t length)
+{
+    Shard* shard = GetShard(key);
+    AutoLocker locker(&shard->lock);
+    return shard->cache.Get(key, buff, length);
+}
+
+int32_t ShardedKVCache::Peek(uint64_t key, char* buff, uint32_t length)
+{
+    Shard* shard = GetShard(key);
+    AutoLocker locker(&shard->lock);
+    return shard->cache.Peek(key, buff, length);
+}
+
+int32_t ShardedKVCache::Consume(uint64_t key, uint32_t length)
+{
+    Shard* shard = GetShard(key);
+    AutoLocker locker(&shard->lock);
+    return shard->cache.Consume(key, length);
+}
+
+int32_t ShardedKVCache::GetSize(uint64_t key)
+{
+    Shard* shard = GetShard(key);
+    AutoLocker locker(&shard->lock);
+    return shard->cache.GetSize(key);
+}
+
+int32_t ShardedKVCache::Del(uint64_t key)
+{
+    Shard* shard = GetShard(key);
+    AutoLocker locker(&shard->lock);
+    return shard->cache.Del(key);
+}
+
+int32_t ShardedKVCache::SetTTL(uint64_t key, uint32_t ttl_ms)
+{
+    Shard* shard = GetShard(key);
+    AutoLocker locker(&shard->lock);
+    return shard->cache.SetTTL(key, ttl_ms);
+}
+
+void ShardedKVCache::SetEvictPolicy(KVCache::EvictPolicy policy)
+{
+    for (uint32_t idx = 0; NULL != m_shards && idx <= m_shard_mask; ++idx)
+    {
+        AutoLocker locker(&m_shards[idx].lock);
+        m_shards[idx].cache.SetEvictPolicy(policy);
+    }
+}
+
+int32_t ShardedKVCache::ExpireScan(uint32_t scan_num)
+{
+    int32_t expire_num = 0;
+    for (uint32_t idx = 0; NULL != m_shards && idx <= m_shard_mask; ++idx)
+    {
+        AutoLocker locker(&m_shards[idx].lock);
+        expire_num += m_shards[idx].cache.ExpireScan(scan_num);
+    }
+    return expire_num;
+}
+
+void ShardedKVCache::GetStats(KVCache::Stats* stats)
+{
+    if (NULL == stats)
+    {
+        return;
+    }
+
+    *stats = KVCache::Stats();
+    for (uint32_t idx = 0; NULL != m_shards && idx <= m_shard_mask; ++idx)
+    {
+        KVCache::Stats shard_stats;
+        {
+            AutoLocker locker(&m_shards[idx].lock);
+            m_shards[idx].cache.GetStats(&shard_stats);
+        }
+        stats->Add(shard_stats);
+    }
+}
+
+uint32_t ShardedKVCache::GetBlockClassStats(KVCache::BlockClassStats* stats, uint32_t num)
+{
+    if (NULL == stats || NULL == m_shards)
+    {
+        return 0;
+    }
+
+    // 各分片的级别配置相同
+    uint32_t class_num = 0;
+    for (uint32_t idx = 0; idx <= m_shard_mask; ++idx)
+    {
+        KVCache::BlockClassStats shard_stats[KVCache::kMAX_BLOCK_CLASS_NUM];
+        uint32_t shard_class_num = 0;
+        {
+            AutoLocker locker(&m_shards[idx].lock);
+            shard_class_num = m_shards[idx].cache.GetBlockClassStats(shard_stats,
+                KVCache::kMAX_BLOCK_CLASS_NUM);
+        }
+        class_num = std::min(shard_class_num, num);
+        for (uint32_t i = 0; i < class_num; ++i)
+        {
+            if (0 == idx)
+            {
+                stats[i] = shard_stats[i];
+                continue;
+            }
+            stats[i].block_num += shard_stats[i].block_num;
+            stats[i].free_block_num += shard_stats[i].free_block_num;
+            stats[i].key_num += shard_stats[i].key_num;
+            stats[i].data_size += shard_stats[i].data_size;
+        }
+    }
+    return class_num;
+}
+
+} // namespace pebble
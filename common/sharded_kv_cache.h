@@ -0,0 +1,117 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#ifndef _PEBBLE_SHARDED_KV_CACHE_H
+#define _PEBBLE_SHARDED_KV_CACHE_H
+
+#include "common/kv_cache.h"
+#include "common/mutex.h"
+#include "common/platform.h"
+
+namespace pebble {
+
+/// @brief 线程安全的KVCache，按key的hash分为多个独立的分片
+///   每个分片有自己的KVCache(索引、块池、空闲链表)和锁，不同分片的操作互不影响
+/// @note 不提供PeekV，返回的指针在释放分片锁后可能失效
+class ShardedKVCache
+{
+public:
+    ShardedKVCache();
+    ~ShardedKVCache();
+
+    /// @brief 初始化
+    /// @param shard_num 分片数，向上取整为2的幂，一般取线程数的2~4倍
+    /// @param max_frame_num 最大缓存的key数(所有分片合计)，0表示与block_num相同
+    /// @param block_num 缓存的块数(所有分片合计)，0表示KVCache::kDEFAULT_BLOCK_NUM
+    /// @param block_size 缓存的块大小，0表示KVCache::kDEFAULT_BLOCK_SIZE
+    /// @return 0 成功，<0 失败，失败时已初始化的分片被释放，可以重新Init
+    int32_t Init(uint32_t shard_num, uint32_t max_frame_num, uint32_t block_num, uint32_t block_size);
+
+    /// @brief 使用多个块大小级别初始化，每个级别的块数平均分到各分片
+    /// @see KVCache::Init
+    int32_t Init(uint32_t shard_num, uint32_t max_frame_num, const KVCache::BlockClass* classes,
+        uint32_t class_num);
+
+    /// @see KVCache::Put
+    int32_t Put(uint64_t key, const char* buff, uint32_t length, bool is_overwrite = false);
+
+    /// @see KVCache::Get
+    int32_t Get(uint64_t key, char* buff, uint32_t length);
+
+    /// @see KVCache::Peek
+    int32_t Peek(uint64_t key, char* buff, uint32_t length);
+
+    /// @see KVCache::Consume
+    int32_t Consume(uint64_t key, uint32_t length);
+
+    /// @see KVCache::GetSize
+    int32_t GetSize(uint64_t key);
+
+    /// @see KVCache::Del
+    int32_t Del(uint64_t key);
+
+    /// @see KVCache::SetTTL
+    int32_t SetTTL(uint64_t key, uint32_t ttl_ms);
+
+    /// @brief 设置所有分片的淘汰策略
+    /// @see KVCache::SetEvictPolicy
+    void SetEvictPolicy(KVCache::EvictPolicy policy);
+
+    /// @brief 每个分片增量扫描回收过期的key
+    /// @see KVCache::ExpireScan
+    int32_t ExpireScan(uint32_t scan_num);
+
+    /// @brief 获取所有分片合计的运行统计
+    void GetStats(KVCache::Stats* stats);
+
+    /// @brief 获取所有分片合计的各块大小级别占用统计
+    /// @see KVCache::GetBlockClassStats
+    uint32_t GetBlockClassStats(KVCache::BlockClassStats* stats, uint32_t num);
+
+    uint32_t GetShardNum() const { return m_shard_mask + 1; }
+
+private:
+    ShardedKVCache(const ShardedKVCache&);
+    ShardedKVCache& operator=(const ShardedKVCache&);
+
+    /// @brief 分片按缓存行对齐，相邻分片的锁不共享缓存行
+    struct Shard
+    {
+        Mutex   lock;
+        KVCache cache;
+    } __attribute__((aligned(PEBBLE_CACHELINE_SIZE)));
+
+    /// @brief 分配分片，shard_num向上取整为2的幂
+    /// @return 实际分片数，0表示失败
+    uint32_t AllocShards(uint32_t shard_num);
+
+    /// @brief 析构并释放所有分片，之后可以重新Init
+    void FreeShards();
+
+    Shard* GetShard(uint64_t key)
+    {
+        // 与KVCache内部的hash(取乘积高位)不同，这里用fmix64取低位，避免分片内key分布不均
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdULL;
+        key ^= key >> 33;
+        return m_shards + (key & m_shard_mask);
+    }
+
+    Shard*   m_shards;
+    uint32_t m_shard_mask;
+};
+
+} // namespace pebble
+
+#endif // _PEBBLE_SHARDED_KV_CACHE_H
@@ -0,0 +1,238 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#ifndef _PEBBLE_COMMON_SPSC_RING_H_
+#define _PEBBLE_COMMON_SPSC_RING_H_
+
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cstddef>
+
+#include "common/platform.h"
+
+namespace pebble {
+
+
+/// @brief 无锁有界单生产者单消费者环形队列，FIFO
+///   Push系列只能在唯一的生产者线程调用，Pop系列只能在唯一的消费者线程调用
+///   生产者和消费者各自缓存对方的位置，只在缓存显示满/空时才读取对方的缓存行
+/// @note 可选eventfd通知，消费者可将GetEventFd()加入Epoll(EPOLLIN)，用法：
+///   1. 消费者取空队列后调用PrepareWait()，返回true才进入epoll等待
+///   2. fd可读时调用AckEvent()，然后继续PopFront
+///   生产者只在消费者登记等待时写eventfd，连续生产时没有系统调用
+template <typename T>
+class SpscRing
+{
+public:
+    typedef T ValueType;
+
+    /// @param capacity 容量，向上取整为2的幂
+    explicit SpscRing(size_t capacity = 4096)
+        : m_tail(0), m_head_cache(0), m_head(0), m_tail_cache(0),
+          m_event_fd(-1), m_consumer_waiting(0)
+    {
+        size_t size = 2;
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+        m_mask = size - 1;
+        m_buffer = new T[size];
+    }
+
+    ~SpscRing()
+    {
+        if (m_event_fd >= 0)
+        {
+            close(m_event_fd);
+        }
+        delete [] m_buffer;
+    }
+
+    /// @brief 开启eventfd通知，需在生产和消费开始前调用
+    /// @return >=0 eventfd，-1 失败，原因见errno
+    int32_t EnableEventFd()
+    {
+        if (m_event_fd < 0)
+        {
+            m_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        }
+        return m_event_fd;
+    }
+
+    /// @return eventfd，未开启时为-1
+    int32_t GetEventFd() const
+    {
+        return m_event_fd;
+    }
+
+    /// @brief try push element in to back of queue
+    /// @param value to be pushed
+    /// @note if queue is full, return false
+    bool TryPushBack(const T& value)
+    {
+        return PushBackBatch(&value, 1) == 1;
+    }
+
+    /// @brief push elements in to back of queue
+    /// @param values elements to be pushed
+    /// @param num number of elements
+    /// @return number of elements pushed, less than num when queue is full
+    uint32_t PushBackBatch(const T* values, uint32_t num)
+    {
+        size_t tail = m_tail;
+        size_t capacity = m_mask + 1;
+        if (tail - m_head_cache + num > capacity)
+        {
+            m_head_cache = __atomic_load_n(&m_head, __ATOMIC_ACQUIRE);
+        }
+        size_t space = capacity - (tail - m_head_cache);
+        uint32_t push_num = space < num ? static_cast<uint32_t>(space) : num;
+        if (0 == push_num)
+        {
+            return 0;
+        }
+
+        for (uint32_t i = 0; i < push_num; ++i)
+        {
+            m_buffer[(tail + i) & m_mask] = values[i];
+        }
+        __atomic_store_n(&m_tail, tail + push_num, __ATOMIC_RELEASE);
+        Notify();
+        return push_num;
+    }
+
+    /// @brief Try popup from front of queue
+    /// @param value to hold the result
+    /// @note if queue is empty, return false
+    bool TryPopFront(T* value)
+    {
+        return PopFrontBatch(value, 1) == 1;
+    }
+
+    /// @brief popup elements from front of queue
+    /// @param values to hold the result
+    /// @param max_num max number of elements to popup
+    /// @return number of elements popped, 0 when queue is empty
+    uint32_t PopFrontBatch(T* values, uint32_t max_num)
+    {
+        size_t head = m_head;
+        if (m_tail_cache - head < max_num)
+        {
+            m_tail_cache = __atomic_load_n(&m_tail, __ATOMIC_ACQUIRE);
+        }
+        size_t avail = m_tail_cache - head;
+        uint32_t pop_num = avail < max_num ? static_cast<uint32_t>(avail) : max_num;
+        if (0 == pop_num)
+        {
+            return 0;
+        }
+
+        for (uint32_t i = 0; i < pop_num; ++i)
+        {
+            T& slot = m_buffer[(head + i) & m_mask];
+            values[i] = slot;
+            slot = T();
+        }
+        __atomic_store_n(&m_head, head + pop_num, __ATOMIC_RELEASE);
+        return pop_num;
+    }
+
+    /// @brief 消费者在等待eventfd前调用，登记等待状态
+    /// @return true 队列为空，可以等待；false 队列非空，应继续消费
+    bool PrepareWait()
+    {
+        __atomic_store_n(&m_consumer_waiting, 1, __ATOMIC_RELAXED);
+        // 与Notify中先发布数据再检查等待状态配对，保证不会丢失通知
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (!IsEmpty())
+        {
+            __atomic_store_n(&m_consumer_waiting, 0, __ATOMIC_RELAXED);
+            return false;
+        }
+        return true;
+    }
+
+    /// @brief 消费者在eventfd可读后调用，清除eventfd计数
+    void AckEvent()
+    {
+        uint64_t count = 0;
+        ssize_t ret = read(m_event_fd, &count, sizeof(count));
+        (void)ret;
+    }
+
+    /// @brief approximate number of elements
+    size_t Size() const
+    {
+        size_t head = __atomic_load_n(&m_head, __ATOMIC_ACQUIRE);
+        size_t tail = __atomic_load_n(&m_tail, __ATOMIC_ACQUIRE);
+        return tail - head;
+    }
+
+    size_t Capacity() const
+    {
+        return m_mask + 1;
+    }
+
+    bool IsEmpty() const
+    {
+        return Size() == 0;
+    }
+
+    bool IsFull() const
+    {
+        return Size() >= Capacity();
+    }
+
+private:
+    SpscRing(const SpscRing&);
+    SpscRing& operator=(const SpscRing&);
+
+    void Notify()
+    {
+        if (m_event_fd < 0)
+        {
+            return;
+        }
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&m_consumer_waiting, __ATOMIC_RELAXED) != 0
+            && __atomic_exchange_n(&m_consumer_waiting, 0, __ATOMIC_RELAXED) != 0)
+        {
+            uint64_t one = 1;
+            ssize_t ret = write(m_event_fd, &one, sizeof(one));
+            (void)ret;
+        }
+    }
+
+    // 生产者
+    size_t m_tail;
+    size_t m_head_cache;
+    char m_pad1[PEBBLE_CACHELINE_SIZE - sizeof(size_t) * 2];
+    // 消费者
+    size_t m_head;
+    size_t m_tail_cache;
+    char m_pad2[PEBBLE_CACHELINE_SIZE - sizeof(size_t) * 2];
+    // 通知
+    int32_t m_event_fd;
+    int32_t m_consumer_waiting;
+    char m_pad3[PEBBLE_CACHELINE_SIZE - sizeof(int32_t) * 2];
+    // 只读
+    T* m_buffer;
+    size_t m_mask;
+};
+
+} // namespace pebble
+
+#endif // _PEBBLE_COMMON_SPSC_RING_H_
@@ -14,6 +14,7 @@
 
 #include "common/thread.h"
 #include <pthread.h>
+#include <sched.h>
 
 namespace pebble {
 
@@ -31,12 +32,41 @@ static void* ThreadEntry(void* arg) {
     return NULL;
 }
 
+void Thread::SetAttr(const Attr& attr) {
+    m_attr = attr;
+}
+
 bool Thread::Start() {
-    if (::pthread_create(&m_thread_id, NULL, ThreadEntry, this) != 0) {
+    pthread_attr_t attr;
+    if (::pthread_attr_init(&attr) != 0) {
         return false;
     }
 
-    return true;
+    bool ok = true;
+    if (m_attr.stack_size > 0) {
+        ok = ok && ::pthread_attr_setstacksize(&attr, m_attr.stack_size) == 0;
+    }
+    if (m_attr.sched_policy >= 0) {
+        struct sched_param param;
+        param.sched_priority = m_attr.sched_priority;
+        ok = ok && ::pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED) == 0
+            && ::pthread_attr_setschedpolicy(&attr, m_attr.sched_policy) == 0
+            && ::pthread_attr_setschedparam(&attr, &param) == 0;
+    }
+    if (!m_attr.cpus.empty()) {
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        for (size_t i = 0; i < m_attr.cpus.size(); i++) {
+            if (m_attr.cpus[i] >= 0 && m_attr.cpus[i] < CPU_SETSIZE) {
+                CPU_SET(m_attr.cpus[i], &cpu_set);
+            }
+        }
+        ok = ok && ::pthread_attr_setaffinity_np(&attr, sizeof(cpu_set), &cpu_set) == 0;
+    }
+
+    ok = ok && ::pthread_create(&m_thread_id, &attr, ThreadEntry, this) == 0;
+    ::pthread_attr_destroy(&attr);
+    return ok;
 }
 
 bool Thread::Join() {
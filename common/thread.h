@@ -16,6 +16,9 @@
 #define _PEBBLE_COMMON_THREAD_H_
 
 #include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
 
 namespace pebble {
 
@@ -23,11 +26,25 @@ namespace pebble {
 class Thread
 {
 public:
+    // 线程属性，在Start前通过SetAttr设置
+    struct Attr
+    {
+        Attr() : stack_size(0), sched_policy(-1), sched_priority(0) {}
+        size_t stack_size;          // 栈大小(字节)，0为系统默认
+        int32_t sched_policy;       // 调度策略，如SCHED_OTHER/SCHED_FIFO/SCHED_RR，<0为继承创建者
+        int32_t sched_priority;     // 调度优先级，实时调度策略时有效
+        std::vector<int32_t> cpus;  // 允许运行的CPU，为空时不绑定
+    };
+
     Thread();
     virtual ~Thread();
 
     virtual void Run() = 0;
 
+    void SetAttr(const Attr& attr);
+
+    /// @brief 按属性创建线程并执行Run
+    /// @return false 创建失败，如CPU不在进程允许范围内、实时调度策略没有权限
     bool Start();
 
     bool Join();
@@ -35,6 +52,7 @@ public:
     void Exit();
 private:
     ::pthread_t m_thread_id;
+    Attr m_attr;
 };
 
 } // namespace pebble
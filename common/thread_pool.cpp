@@ -12,27 +12,92 @@
  */
 
 
+#include <limits.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
 #include <iostream>
 
+#include "common/cpu.h"
+#include "common/futex.h"
 #include "common/thread_pool.h"
+#include "common/time_utility.h"
 
 namespace pebble {
 
 
-ThreadPool::ThreadPool() : m_exit(false), m_initialized(false),
-    m_thread_num(0), m_mode(PENDING) {
+// 当前线程所属的工作窃取线程池及线程下标，用于把线程池内提交的任务放入本线程队列
+static __thread ThreadPool* t_current_pool = NULL;
+static __thread uint32_t t_worker_index = 0;
+
+static uint32_t NextRand(uint64_t* seed) {
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 7;
+    *seed ^= *seed << 17;
+    return static_cast<uint32_t>(*seed);
+}
+
+static inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __asm__ __volatile__("pause" ::: "memory");
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield" ::: "memory");
+#else
+    __asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+static uint32_t LatencyBucket(int64_t us) {
+    if (us <= 0) {
+        return 0;
+    }
+    uint32_t bucket = 64 - __builtin_clzll(static_cast<uint64_t>(us));
+    return bucket < ThreadPool::kLATENCY_BUCKET_NUM ? bucket : ThreadPool::kLATENCY_BUCKET_NUM - 1;
+}
+
+// 计数只由所属线程写入，不需要原子的读-改-写
+static inline void AddCounter(uint64_t* counter, uint64_t value) {
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+}
+
+ThreadPool::Snapshot::Snapshot() : thread_num(0), max_thread_num(0), spawn_num(0), retire_num(0),
+    pending_task_num(0), working_thread_num(0), rejected_num(0), expired_num(0),
+    executed_num(0), wait_time_us(0), exec_time_us(0), park_num(0) {
+    memset(wait_hist, 0, sizeof(wait_hist));
+    memset(exec_hist, 0, sizeof(exec_hist));
+}
+
+ThreadPool::ThreadPool() : m_counters(NULL), m_active_num(0), m_rejected_num(0),
+    m_exit(false), m_initialized(false),
+    m_thread_num(0), m_mode(PENDING), m_work_stealing(false), m_waiting(true),
+    m_inject_queue(NULL), m_spin_num(0), m_yield_num(0), m_park_timeout_ms(-1),
+    m_task_seq(0), m_sleeper_num(0), m_elastic(false), m_min_thread_num(0), m_spawn_wait_us(0),
+    m_idle_timeout_us(0), m_live_num(0), m_last_dequeue_us(0), m_spawn_num(0), m_retire_num(0),
+    m_priority_queue(false), m_drop_expired(false), m_aging_us(0), m_priority_seq(0) {
 }
 
 
 ThreadPool::~ThreadPool() {
     Terminate();
+    free(m_counters);
 }
 
 int ThreadPool::Init(int32_t thread_num, int32_t mode) {
+    Options options;
+    options.thread_num = thread_num;
+    options.mode = mode;
+    return Init(options);
+}
+
+int ThreadPool::Init(const Options& options) {
     if (m_initialized) {
         return -1;
     }
 
+    int32_t thread_num = options.thread_num;
+    int32_t mode = options.mode;
     if (thread_num <= 0) {
         return -2;
     }
@@ -40,18 +105,76 @@ int ThreadPool::Init(int32_t thread_num, int32_t mode) {
     if (thread_num > 256) {
         thread_num = 256;
     }
-    m_thread_num = thread_num;
+
+    // 弹性伸缩时按上限分配各线程位置，启动时只创建thread_num个线程
+    int32_t max_thread_num = std::min(std::max(options.max_thread_num, thread_num), 256);
+    m_elastic = max_thread_num > thread_num;
+    m_min_thread_num = thread_num;
+    m_thread_num = max_thread_num;
+    m_spawn_wait_us = options.spawn_wait_ms * 1000LL;
+    m_idle_timeout_us = options.idle_timeout_ms * 1000LL;
 
     if (mode >= NO_PENDING || mode < PENDING) {
         m_mode = mode;
     }
 
-    for (int32_t i = 0; i < thread_num; i++) {
+    free(m_counters);
+    void* mem = NULL;
+    if (posix_memalign(&mem, PEBBLE_CACHELINE_SIZE, sizeof(WorkerCounter) * m_thread_num) != 0) {
+        m_counters = NULL;
+        return -3;
+    }
+    memset(mem, 0, sizeof(WorkerCounter) * m_thread_num);
+    m_counters = static_cast<WorkerCounter*>(mem);
+    m_active_num = 0;
+    m_rejected_num = 0;
+    m_live_num = 0;
+    m_spawn_num = 0;
+    m_retire_num = 0;
+    m_last_dequeue_us = TimeUtility::GetCurrentUS();
+
+    InitPlacement(options, &m_attrs);
+
+    // 单核时自旋只会推迟提交任务的线程运行
+    m_spin_num = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? options.spin_num : 0;
+    m_yield_num = options.yield_num;
+    m_park_timeout_ms = options.park_timeout_ms;
+    // 弹性伸缩时空闲线程需要定期醒来检查是否退出
+    if (m_elastic && (m_park_timeout_ms < 0 || m_park_timeout_ms > options.idle_timeout_ms)) {
+        m_park_timeout_ms = options.idle_timeout_ms;
+    }
 
-        InnerThread* thread = new InnerThread(&m_pending_queue, &m_finished_queue, &m_working_queue);
-        m_threads.push_back(thread);
+    m_priority_queue = options.priority_queue;
+    m_drop_expired = options.drop_expired;
+    m_aging_us = options.aging_ms * 1000LL;
+
+    m_exit = false;
+    m_work_stealing = options.work_stealing;
+    if (m_work_stealing) {
+        m_inject_queue = new MpmcRing<Task*>(options.global_queue_size);
+        bool numa_local = false;
+        for (uint32_t i = 0; i < m_thread_num; i++) {
+            Worker* worker = new Worker(options.local_queue_size);
+            worker->seed = 0x9E3779B97F4A7C15ULL * (i + 1);
+            worker->node = m_worker_node[i];
+            numa_local = numa_local || worker->node >= 0;
+            m_workers.push_back(worker);
+        }
+        if (numa_local && m_node_cpus.size() > 1) {
+            for (size_t i = 0; i < m_node_cpus.size(); i++) {
+                m_node_queues.push_back(new MpmcRing<Task*>(options.global_queue_size));
+            }
+        }
+        m_stealing_threads.assign(m_thread_num, NULL);
+    } else {
+        m_threads.assign(m_thread_num, NULL);
+    }
 
-        thread->Start();
+    for (int32_t i = 0; i < thread_num; i++) {
+        if (!StartWorker(i)) {
+            Terminate(false);
+            return -4;
+        }
     }
 
     m_initialized = true;
@@ -59,50 +182,413 @@ int ThreadPool::Init(int32_t thread_num, int32_t mode) {
     return 0;
 }
 
+void ThreadPool::InitPlacement(const Options& options, std::vector<Thread::Attr>* attrs) {
+    m_node_cpus.clear();
+    m_cpu_node.clear();
+    m_worker_node.assign(m_thread_num, -1);
+
+    // 节点内只保留options.cpus中的CPU，去掉因此为空的节点
+    std::vector<std::vector<int32_t> > nodes;
+    GetNumaNodes(&nodes);
+    for (size_t i = 0; i < nodes.size(); i++) {
+        std::vector<int32_t> cpus;
+        for (size_t j = 0; j < nodes[i].size(); j++) {
+            if (options.cpus.empty() || std::find(options.cpus.begin(), options.cpus.end(),
+                nodes[i][j]) != options.cpus.end()) {
+                cpus.push_back(nodes[i][j]);
+            }
+        }
+        if (!cpus.empty()) {
+            m_node_cpus.push_back(cpus);
+        }
+    }
+    for (size_t i = 0; i < m_node_cpus.size(); i++) {
+        for (size_t j = 0; j < m_node_cpus[i].size(); j++) {
+            size_t cpu = m_node_cpus[i][j];
+            if (cpu >= m_cpu_node.size()) {
+                m_cpu_node.resize(cpu + 1, -1);
+            }
+            m_cpu_node[cpu] = i;
+        }
+    }
+
+    attrs->resize(m_thread_num);
+    for (uint32_t i = 0; i < m_thread_num; i++) {
+        Thread::Attr& attr = (*attrs)[i];
+        attr.stack_size = options.stack_size;
+        attr.sched_policy = options.sched_policy;
+        attr.sched_priority = options.sched_priority;
+        if (options.numa_spread && !m_node_cpus.empty()) {
+            int32_t node = i % m_node_cpus.size();
+            attr.cpus = m_node_cpus[node];
+            m_worker_node[i] = node;
+        } else if (!options.cpus.empty()) {
+            size_t cpu = options.cpus[i % options.cpus.size()];
+            attr.cpus.push_back(cpu);
+            m_worker_node[i] = cpu < m_cpu_node.size() ? m_cpu_node[cpu] : -1;
+        }
+    }
+}
+
+bool ThreadPool::StartWorker(uint32_t index) {
+    // 位置上可能留有已退出线程的对象
+    Thread* thread = NULL;
+    if (m_work_stealing) {
+        thread = m_stealing_threads[index];
+        m_stealing_threads[index] = NULL;
+    } else {
+        thread = m_threads[index];
+        m_threads[index] = NULL;
+    }
+    if (thread != NULL) {
+        thread->Join();
+        delete thread;
+    }
+
+    if (m_work_stealing) {
+        thread = new StealingThread(this, index);
+    } else {
+        thread = new InnerThread(this, index);
+    }
+    thread->SetAttr(m_attrs[index]);
+    __atomic_store_n(&m_counters[index].live, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&m_live_num, 1, __ATOMIC_RELAXED);
+    if (!thread->Start()) {
+        __atomic_store_n(&m_counters[index].live, 0, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&m_live_num, 1, __ATOMIC_RELAXED);
+        delete thread;
+        return false;
+    }
+
+    if (m_work_stealing) {
+        m_stealing_threads[index] = static_cast<StealingThread*>(thread);
+    } else {
+        m_threads[index] = static_cast<InnerThread*>(thread);
+    }
+    return true;
+}
+
+bool ThreadPool::NeedGrow() {
+    // 有任务在排队且没有线程在睡眠等待任务
+    int32_t live = __atomic_load_n(&m_live_num, __ATOMIC_RELAXED);
+    return live < static_cast<int32_t>(m_thread_num)
+        && __atomic_load_n(&m_active_num, __ATOMIC_RELAXED) > live
+        && __atomic_load_n(&m_sleeper_num, __ATOMIC_RELAXED) == 0;
+}
+
+void ThreadPool::TryGrow() {
+    // 已有线程在扩容或正在Terminate时直接返回，不阻塞提交任务和执行任务的线程
+    if (!m_resize_mutex.TryLock()) {
+        return;
+    }
+    if (!__atomic_load_n(&m_exit, __ATOMIC_ACQUIRE)
+        && __atomic_load_n(&m_live_num, __ATOMIC_RELAXED) < static_cast<int32_t>(m_thread_num)) {
+        for (uint32_t i = 0; i < m_thread_num; i++) {
+            if (__atomic_load_n(&m_counters[i].live, __ATOMIC_ACQUIRE) != 0) {
+                continue;
+            }
+            if (StartWorker(i)) {
+                __atomic_add_fetch(&m_spawn_num, 1, __ATOMIC_RELAXED);
+                // 新线程取到任务前不再重复扩容
+                __atomic_store_n(&m_last_dequeue_us, TimeUtility::GetCurrentUS(), __ATOMIC_RELAXED);
+            }
+            break;
+        }
+    }
+    m_resize_mutex.UnLock();
+}
+
+bool ThreadPool::TryRetire(uint32_t index, int64_t* idle_since) {
+    int64_t now = TimeUtility::GetCurrentUS();
+    if (now - *idle_since < m_idle_timeout_us || __atomic_load_n(&m_exit, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    bool has_task = m_work_stealing ? HasStealingTask() : HasPendingTask();
+    if (has_task) {
+        return false;
+    }
+
+    int32_t live = __atomic_load_n(&m_live_num, __ATOMIC_RELAXED);
+    do {
+        if (live <= static_cast<int32_t>(m_min_thread_num)) {
+            // 已是下限，重新计时，避免每次醒来都检查
+            *idle_since = now;
+            return false;
+        }
+    } while (!__atomic_compare_exchange_n(&m_live_num, &live, live - 1, true,
+        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    // 线程对象由之后复用该位置的StartWorker或Terminate回收
+    __atomic_add_fetch(&m_retire_num, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&m_counters[index].live, 0, __ATOMIC_RELEASE);
+    return true;
+}
+
+int32_t ThreadPool::CurrentNode() {
+    int32_t cpu = GetCurrentCpu();
+    if (cpu < 0 || static_cast<size_t>(cpu) >= m_cpu_node.size()) {
+        return -1;
+    }
+    return m_cpu_node[cpu];
+}
+
 int ThreadPool::AddTask(cxx::function<void()>& fun, int64_t task_id) {
+    return SubmitTask(fun, task_id, false, TaskOptions());
+}
+
+int ThreadPool::AddLocalTask(cxx::function<void()>& fun, int64_t task_id) {
+    return SubmitTask(fun, task_id, true, TaskOptions());
+}
+
+int ThreadPool::AddTask(cxx::function<void()>& fun, const TaskOptions& task_options,
+    int64_t task_id) {
+    return SubmitTask(fun, task_id, false, task_options);
+}
+
+int ThreadPool::SubmitTask(cxx::function<void()>& fun, int64_t task_id, bool local,
+    const TaskOptions& task_options) {
     if (!m_initialized) {
         return -1;
     }
 
     if (m_mode == NO_PENDING) {
-        Stats stat;
-        GetStatus(&stat);
-        if (stat.working_thread_num + stat.pending_task_num >= m_thread_num) {
-            return -2;
-        }
+        // 预占一个名额，保证正在执行和等待执行的任务总数不超过线程数
+        int32_t active = __atomic_load_n(&m_active_num, __ATOMIC_RELAXED);
+        do {
+            if (active >= static_cast<int32_t>(m_thread_num)) {
+                __atomic_add_fetch(&m_rejected_num, 1, __ATOMIC_RELAXED);
+                return -2;
+            }
+        } while (!__atomic_compare_exchange_n(&m_active_num, &active, active + 1, true,
+            __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    } else {
+        __atomic_add_fetch(&m_active_num, 1, __ATOMIC_RELAXED);
     }
 
-    Task t;
-    t.fun = fun;
-    t.task_id = task_id;
+    int64_t now = TimeUtility::GetCurrentUS();
+    if (m_priority_queue) {
+        Task* task = new Task;
+        task->fun = fun;
+        task->task_id = task_id;
+        task->enqueue_us = now;
+        int32_t priority = task_options.priority > 0 ? task_options.priority : 0;
+        task->sched_us = now + priority * m_aging_us;
+        if (task_options.timeout_ms >= 0) {
+            task->deadline_us = now + task_options.timeout_ms * 1000LL;
+            task->sched_us = std::min(task->sched_us, task->deadline_us);
+        }
+        PushPriorityTask(task);
+    } else if (m_work_stealing) {
+        Task* task = new Task;
+        task->fun = fun;
+        task->task_id = task_id;
+        task->enqueue_us = now;
+        PushStealingTask(task, local);
+    } else {
+        Task t;
+        t.fun = fun;
+        t.task_id = task_id;
+        t.enqueue_us = now;
+        m_pending_queue.PushBack(t);
+        WakeUpIdle();
+    }
 
-    m_pending_queue.PushBack(t);
+    // 一段时间没有线程取任务，说明线程都在忙
+    if (m_elastic && now - __atomic_load_n(&m_last_dequeue_us, __ATOMIC_RELAXED)
+        >= m_spawn_wait_us && NeedGrow()) {
+        TryGrow();
+    }
 
     return 0;
 }
 
+// 小顶堆，最晚开始时间最早的在堆顶
+bool ThreadPool::LaterTask(const Task* left, const Task* right) {
+    if (left->sched_us != right->sched_us) {
+        return left->sched_us > right->sched_us;
+    }
+    return left->sched_seq > right->sched_seq;
+}
+
+void ThreadPool::PushPriorityTask(Task* task) {
+    {
+        AutoLocker locker(&m_priority_mutex);
+        task->sched_seq = m_priority_seq++;
+        m_priority_heap.push_back(task);
+        std::push_heap(m_priority_heap.begin(), m_priority_heap.end(), LaterTask);
+    }
+    WakeUpIdle();
+}
+
+ThreadPool::Task* ThreadPool::PopPriorityTask() {
+    AutoLocker locker(&m_priority_mutex);
+    if (m_priority_heap.empty()) {
+        return NULL;
+    }
+    std::pop_heap(m_priority_heap.begin(), m_priority_heap.end(), LaterTask);
+    Task* task = m_priority_heap.back();
+    m_priority_heap.pop_back();
+    return task;
+}
+
+void ThreadPool::ClearPriorityTask() {
+    AutoLocker locker(&m_priority_mutex);
+    for (size_t i = 0; i < m_priority_heap.size(); i++) {
+        delete m_priority_heap[i];
+    }
+    m_priority_heap.clear();
+}
+
+bool ThreadPool::HasPendingTask() {
+    if (m_priority_queue) {
+        AutoLocker locker(&m_priority_mutex);
+        return !m_priority_heap.empty();
+    }
+    return !m_pending_queue.IsEmpty();
+}
+
+int32_t ThreadPool::Execute(const cxx::function<void()>& fun) {
+    cxx::function<void()> task = fun;
+    return AddTask(task);
+}
+
 void ThreadPool::GetStatus(Stats* stat) {
     if (stat == NULL) {
         return;
     }
-    stat->pending_task_num = m_pending_queue.Size();
-    stat->working_thread_num = m_working_queue.Size();
+    size_t working = WorkingThreadNum();
+    int32_t active = __atomic_load_n(&m_active_num, __ATOMIC_RELAXED);
+    stat->working_thread_num = working;
+    stat->pending_task_num = active > static_cast<int32_t>(working) ? active - working : 0;
+}
+
+void ThreadPool::GetSnapshot(Snapshot* snapshot) {
+    if (snapshot == NULL) {
+        return;
+    }
+    *snapshot = Snapshot();
+    Stats stat;
+    GetStatus(&stat);
+    snapshot->thread_num = __atomic_load_n(&m_live_num, __ATOMIC_RELAXED);
+    snapshot->max_thread_num = m_thread_num;
+    snapshot->spawn_num = __atomic_load_n(&m_spawn_num, __ATOMIC_RELAXED);
+    snapshot->retire_num = __atomic_load_n(&m_retire_num, __ATOMIC_RELAXED);
+    snapshot->pending_task_num = stat.pending_task_num;
+    snapshot->working_thread_num = stat.working_thread_num;
+    snapshot->rejected_num = __atomic_load_n(&m_rejected_num, __ATOMIC_RELAXED);
+    if (m_counters == NULL) {
+        return;
+    }
+    for (uint32_t i = 0; i < m_thread_num; i++) {
+        WorkerCounter* counter = &m_counters[i];
+        snapshot->executed_num += __atomic_load_n(&counter->executed_num, __ATOMIC_RELAXED);
+        snapshot->wait_time_us += __atomic_load_n(&counter->wait_time_us, __ATOMIC_RELAXED);
+        snapshot->exec_time_us += __atomic_load_n(&counter->exec_time_us, __ATOMIC_RELAXED);
+        snapshot->park_num += __atomic_load_n(&counter->park_num, __ATOMIC_RELAXED);
+        snapshot->expired_num += __atomic_load_n(&counter->expired_num, __ATOMIC_RELAXED);
+        for (uint32_t j = 0; j < kLATENCY_BUCKET_NUM; j++) {
+            snapshot->wait_hist[j] += __atomic_load_n(&counter->wait_hist[j], __ATOMIC_RELAXED);
+            snapshot->exec_hist[j] += __atomic_load_n(&counter->exec_hist[j], __ATOMIC_RELAXED);
+        }
+    }
+}
+
+uint64_t ThreadPool::GetPercentile(const uint64_t* hist, double ratio) {
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < kLATENCY_BUCKET_NUM; i++) {
+        total += hist[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t target = static_cast<uint64_t>(total * ratio);
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < kLATENCY_BUCKET_NUM; i++) {
+        sum += hist[i];
+        if (sum > target) {
+            return 1ULL << i;
+        }
+    }
+    return 1ULL << (kLATENCY_BUCKET_NUM - 1);
+}
+
+size_t ThreadPool::WorkingThreadNum() {
+    if (m_counters == NULL) {
+        return 0;
+    }
+    size_t num = 0;
+    for (uint32_t i = 0; i < m_thread_num; i++) {
+        num += __atomic_load_n(&m_counters[i].busy, __ATOMIC_RELAXED);
+    }
+    return num;
+}
+
+void ThreadPool::RunTask(uint32_t index, Task* task) {
+    WorkerCounter* counter = &m_counters[index];
+    int64_t begin = TimeUtility::GetCurrentUS();
+    if (m_drop_expired && task->deadline_us > 0 && begin > task->deadline_us) {
+        __atomic_sub_fetch(&m_active_num, 1, __ATOMIC_RELAXED);
+        AddCounter(&counter->expired_num, 1);
+        return;
+    }
+    __atomic_store_n(&counter->busy, 1, __ATOMIC_RELAXED);
+    task->fun();
+    if (task->task_id >= 0) {
+        m_finished_queue.PushBack(task->task_id);
+    }
+    int64_t end = TimeUtility::GetCurrentUS();
+    __atomic_store_n(&counter->busy, 0, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&m_active_num, 1, __ATOMIC_RELAXED);
+
+    int64_t wait_us = begin > task->enqueue_us ? begin - task->enqueue_us : 0;
+    int64_t exec_us = end > begin ? end - begin : 0;
+    if (m_elastic) {
+        // 取任务时间只需ms精度，减少对共享缓存行的写
+        if (begin - __atomic_load_n(&m_last_dequeue_us, __ATOMIC_RELAXED) >= 1000) {
+            __atomic_store_n(&m_last_dequeue_us, begin, __ATOMIC_RELAXED);
+        }
+        // 任务排队过久，说明线程不够
+        if (wait_us >= m_spawn_wait_us && NeedGrow()) {
+            TryGrow();
+        }
+    }
+    AddCounter(&counter->executed_num, 1);
+    AddCounter(&counter->wait_time_us, wait_us);
+    AddCounter(&counter->exec_time_us, exec_us);
+    AddCounter(&counter->wait_hist[LatencyBucket(wait_us)], 1);
+    AddCounter(&counter->exec_hist[LatencyBucket(exec_us)], 1);
 }
 
 void ThreadPool::Terminate(bool waiting /* = true */) {
-    m_exit = true;
+    if (m_work_stealing) {
+        TerminateStealing(waiting);
+        return;
+    }
+
+    __atomic_store_n(&m_exit, true, __ATOMIC_RELEASE);
+    // 等待进行中的扩容完成，之后不会再创建线程
+    AutoLocker locker(&m_resize_mutex);
     for (size_t i = 0; i < m_threads.size(); i++) {
-        m_threads[i]->Terminate(waiting);
+        if (m_threads[i] != NULL) {
+            m_threads[i]->Terminate(waiting);
+        }
     }
+    WakeUpAll();
 
     for (size_t i = 0; i < m_threads.size(); i++) {
-        m_threads[i]->Join();
-        delete m_threads[i];
+        if (m_threads[i] != NULL) {
+            m_threads[i]->Join();
+            delete m_threads[i];
+        }
     }
 
     m_pending_queue.Clear();
+    ClearPriorityTask();
     m_finished_queue.Clear();
     m_threads.clear();
+    m_active_num = 0;
+    m_live_num = 0;
+    m_initialized = false;
 }
 
 bool ThreadPool::GetFinishedTaskID(int64_t* task_id) {
@@ -110,43 +596,266 @@ bool ThreadPool::GetFinishedTaskID(int64_t* task_id) {
         return false;
     }
 
-    bool ret = m_finished_queue.TimedPopFront(task_id, 1);
-    return ret;
+    return m_finished_queue.TryPopFront(task_id);
 }
 
-ThreadPool::InnerThread::InnerThread(BlockingQueue<Task>* pending_queue,
-    BlockingQueue<int64_t>* finished_queue, BlockingQueue<int64_t>* working_queue) :
-        m_pending_queue(pending_queue),
-        m_finished_queue(finished_queue),
-        m_working_queue(working_queue),
+ThreadPool::InnerThread::InnerThread(ThreadPool* pool, uint32_t index) :
+        m_pool(pool),
+        m_index(index),
         m_exit(false),
         m_waiting(true) {
 }
 
 void ThreadPool::InnerThread::Run() {
+    uint32_t spin_limit = m_pool->m_spin_num;
+    int64_t idle_since = 0;
     while (1) {
-
-        if (m_exit && ((!m_waiting) || (m_waiting && m_pending_queue->IsEmpty()))) {
+        // 先取序号再检查队列，检查之后提交的任务会改变序号，WaitTask不会睡眠
+        int32_t seq = __atomic_load_n(&m_pool->m_task_seq, __ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&m_exit, __ATOMIC_ACQUIRE)
+            && ((!m_waiting) || (m_waiting && !m_pool->HasPendingTask()))) {
             break;
         }
 
-        Task t;
-        bool ret = m_pending_queue->TimedPopFront(&t, 1000);
-        if (ret) {
-            m_working_queue->PushBack(0); // 不关心元素的值，只是通过队列size记录忙的线程数
-            t.fun();
-            if (t.task_id >= 0) {
-                m_finished_queue->PushBack(t.task_id);
+        if (m_pool->m_priority_queue) {
+            Task* task = m_pool->PopPriorityTask();
+            if (task != NULL) {
+                m_pool->RunTask(m_index, task);
+                delete task;
+                idle_since = 0;
+                continue;
             }
-            int64_t tmp;
-            m_working_queue->TryPopBack(&tmp);
+        } else {
+            Task t;
+            if (m_pool->m_pending_queue.TryPopFront(&t)) {
+                m_pool->RunTask(m_index, &t);
+                idle_since = 0;
+                continue;
+            }
+        }
+
+        if (m_pool->m_elastic && idle_since == 0) {
+            idle_since = TimeUtility::GetCurrentUS();
+        }
+        m_pool->WaitTask(m_index, seq, &spin_limit);
+        if (m_pool->m_elastic && m_pool->TryRetire(m_index, &idle_since)) {
+            break;
         }
     }
 }
 
 void ThreadPool::InnerThread::Terminate(bool waiting /* = true */) {
-    m_exit = true;
     m_waiting = waiting;
+    __atomic_store_n(&m_exit, true, __ATOMIC_RELEASE);
+}
+
+void ThreadPool::PushStealingTask(Task* task, bool local) {
+    // 线程池内的任务提交的任务优先放入本线程队列，无锁且局部性好
+    if (t_current_pool == this && m_workers[t_worker_index]->deque.Push(task)) {
+        WakeUpIdle();
+        return;
+    }
+
+    int32_t node = (local && !m_node_queues.empty()) ? CurrentNode() : -1;
+    if (node < 0 || !m_node_queues[node]->TryPushBack(task)) {
+        if (!m_inject_queue->TryPushBack(task)) {
+            m_overflow_queue.PushBack(task);
+        }
+    }
+    WakeUpIdle();
+}
+
+ThreadPool::Task* ThreadPool::GetStealingTask(uint32_t index) {
+    // 优先级调度时所有任务都在优先级队列中
+    if (m_priority_queue) {
+        return PopPriorityTask();
+    }
+
+    Task* task = NULL;
+    Worker* self = m_workers[index];
+    if (self->deque.Pop(&task)) {
+        return task;
+    }
+
+    // 按NUMA节点分布时，先取本节点的任务，再取全局任务，最后才跨节点
+    bool numa_local = self->node >= 0 && !m_node_queues.empty();
+    if (numa_local && m_node_queues[self->node]->TryPopFront(&task)) {
+        return task;
+    }
+    if (m_inject_queue->TryPopFront(&task) || m_overflow_queue.TryPopFront(&task)) {
+        return task;
+    }
+    if (numa_local && StealTask(index, self->node, &task)) {
+        return task;
+    }
+    for (size_t i = 0; i < m_node_queues.size(); i++) {
+        if (m_node_queues[i]->TryPopFront(&task)) {
+            return task;
+        }
+    }
+    if (StealTask(index, -1, &task)) {
+        return task;
+    }
+    return NULL;
+}
+
+bool ThreadPool::StealTask(uint32_t index, int32_t node, Task** task) {
+    // 从随机位置开始依次尝试窃取，避免所有空闲线程挤在同一个对象上
+    Worker* self = m_workers[index];
+    uint32_t worker_num = m_workers.size();
+    uint32_t start = NextRand(&self->seed) % worker_num;
+    for (uint32_t i = 0; i < worker_num; i++) {
+        uint32_t victim = (start + i) % worker_num;
+        if (victim == index || (node >= 0 && m_workers[victim]->node != node)) {
+            continue;
+        }
+        if (m_workers[victim]->deque.Steal(task)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ThreadPool::HasStealingTask() {
+    for (size_t i = 0; i < m_workers.size(); i++) {
+        if (!m_workers[i]->deque.IsEmpty()) {
+            return true;
+        }
+    }
+    for (size_t i = 0; i < m_node_queues.size(); i++) {
+        if (!m_node_queues[i]->IsEmpty()) {
+            return true;
+        }
+    }
+    return !m_inject_queue->IsEmpty() || !m_overflow_queue.IsEmpty()
+        || (m_priority_queue && HasPendingTask());
+}
+
+void ThreadPool::WaitTask(uint32_t index, int32_t seq, uint32_t* spin_limit) {
+    // 自旋等到了任务说明任务间隔短，下次多自旋一些；否则减少自旋，避免空耗CPU
+    uint32_t limit = *spin_limit;
+    for (uint32_t i = 0; i < limit; i++) {
+        if (__atomic_load_n(&m_task_seq, __ATOMIC_ACQUIRE) != seq
+            || __atomic_load_n(&m_exit, __ATOMIC_ACQUIRE)) {
+            *spin_limit = limit * 2 < m_spin_num ? limit * 2 : m_spin_num;
+            return;
+        }
+        CpuRelax();
+    }
+    *spin_limit = limit / 2 > 0 ? limit / 2 : (m_spin_num > 0 ? 1 : 0);
+
+    for (uint32_t i = 0; i < m_yield_num; i++) {
+        if (__atomic_load_n(&m_task_seq, __ATOMIC_ACQUIRE) != seq
+            || __atomic_load_n(&m_exit, __ATOMIC_ACQUIRE)) {
+            return;
+        }
+        sched_yield();
+    }
+
+    // 与WakeUpIdle中先修改序号再检查m_sleeper_num配对，保证不会丢失唤醒
+    __atomic_add_fetch(&m_sleeper_num, 1, __ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&m_exit, __ATOMIC_ACQUIRE)) {
+        AddCounter(&m_counters[index].park_num, 1);
+        FutexWait(&m_task_seq, seq, m_park_timeout_ms);
+    }
+    __atomic_sub_fetch(&m_sleeper_num, 1, __ATOMIC_SEQ_CST);
+}
+
+void ThreadPool::WakeUpIdle() {
+    __atomic_add_fetch(&m_task_seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&m_sleeper_num, __ATOMIC_SEQ_CST) > 0) {
+        FutexWake(&m_task_seq, 1);
+    }
+}
+
+void ThreadPool::WakeUpAll() {
+    __atomic_add_fetch(&m_task_seq, 1, __ATOMIC_SEQ_CST);
+    FutexWake(&m_task_seq, INT_MAX);
+}
+
+void ThreadPool::StealingRun(uint32_t index) {
+    t_current_pool = this;
+    t_worker_index = index;
+
+    uint32_t spin_limit = m_spin_num;
+    int64_t idle_since = 0;
+    while (true) {
+        int32_t seq = __atomic_load_n(&m_task_seq, __ATOMIC_ACQUIRE);
+        // 不等待时不再取任务，未执行的任务由TerminateStealing释放
+        bool exit = __atomic_load_n(&m_exit, __ATOMIC_ACQUIRE);
+        if (exit && !m_waiting) {
+            break;
+        }
+
+        Task* task = GetStealingTask(index);
+        if (task != NULL) {
+            RunTask(index, task);
+            delete task;
+            idle_since = 0;
+            continue;
+        }
+
+        if (exit && !HasStealingTask()) {
+            break;
+        }
+
+        if (m_elastic && idle_since == 0) {
+            idle_since = TimeUtility::GetCurrentUS();
+        }
+        WaitTask(index, seq, &spin_limit);
+        if (m_elastic && TryRetire(index, &idle_since)) {
+            break;
+        }
+    }
+
+    t_current_pool = NULL;
+}
+
+void ThreadPool::TerminateStealing(bool waiting) {
+    m_waiting = waiting;
+    __atomic_store_n(&m_exit, true, __ATOMIC_RELEASE);
+    AutoLocker locker(&m_resize_mutex);
+    WakeUpAll();
+
+    for (size_t i = 0; i < m_stealing_threads.size(); i++) {
+        if (m_stealing_threads[i] != NULL) {
+            m_stealing_threads[i]->Join();
+            delete m_stealing_threads[i];
+        }
+    }
+    m_stealing_threads.clear();
+
+    // 不等待时丢弃未执行的任务
+    Task* task = NULL;
+    for (size_t i = 0; i < m_workers.size(); i++) {
+        while (m_workers[i]->deque.Steal(&task)) {
+            delete task;
+        }
+        delete m_workers[i];
+    }
+    m_workers.clear();
+    if (m_inject_queue != NULL) {
+        while (m_inject_queue->TryPopFront(&task)) {
+            delete task;
+        }
+        delete m_inject_queue;
+        m_inject_queue = NULL;
+    }
+    for (size_t i = 0; i < m_node_queues.size(); i++) {
+        while (m_node_queues[i]->TryPopFront(&task)) {
+            delete task;
+        }
+        delete m_node_queues[i];
+    }
+    m_node_queues.clear();
+    while (m_overflow_queue.TryPopFront(&task)) {
+        delete task;
+    }
+    ClearPriorityTask();
+    m_finished_queue.Clear();
+    m_active_num = 0;
+    m_live_num = 0;
+    m_initialized = false;
 }
 
 
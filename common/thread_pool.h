@@ -17,9 +17,15 @@
 
 /*
     线程池：
-    1、固定线程个数。
+    1、固定线程个数，或在上下限之间随负载弹性伸缩。
     2、线程关系对等。如果有不对等的场景，可以使用不同的线程池。
     3、添加一个任务后，先放到队列里，由多个线程同时去抢，由抢到者负责执行。
+    4、任务完成可以通过Future获取结果或注册后续任务，也可以指定任务ID后轮询GetFinishedTaskID。
+    5、工作窃取模式下每个线程有自己的无锁任务队列，线程池内的任务再提交任务时放入本线程队列，
+       外部线程提交的任务放入全局队列，空闲线程先取本线程队列，再取全局队列，最后随机窃取其他线程的队列。
+    6、线程可以绑定CPU或按NUMA节点分布，按节点分布时工作窃取模式下每个节点有一个任务队列，
+       AddLocalTask提交的任务优先由提交者所在节点的线程执行，窃取时也先窃取同节点的线程。
+    7、可选优先级调度，任务按优先级和截止时间排序执行，等待越久越优先，可丢弃已过截止时间的任务。
 */
 
 #include <pthread.h>
@@ -27,13 +33,18 @@
 #include <vector>
 
 #include "common/blocking_queue.h"
+#include "common/condition_variable.h"
+#include "common/future.h"
+#include "common/mpmc_ring.h"
+#include "common/mutex.h"
 #include "common/platform.h"
 #include "common/thread.h"
+#include "common/work_stealing_deque.h"
 
 namespace pebble {
 
 
-class ThreadPool {
+class ThreadPool : public Executor {
 public:
     // 线程池的运行状态，放到结构体里，便于后面扩展
     struct Stats
@@ -43,11 +54,84 @@ public:
         size_t working_thread_num;  // 处于忙状态的线程数
     };
 
+    static const uint32_t kLATENCY_BUCKET_NUM = 24;
+
+    // 线程池运行统计快照，累计值从Init开始计算
+    struct Snapshot
+    {
+        Snapshot();
+        uint32_t thread_num;        // 当前线程数
+        uint32_t max_thread_num;    // 线程数上限，非弹性伸缩时与thread_num相同
+        uint64_t spawn_num;         // 弹性伸缩新增线程的次数
+        uint64_t retire_num;        // 弹性伸缩退出线程的次数
+        size_t pending_task_num;    // 等待被执行任务数
+        size_t working_thread_num;  // 处于忙状态的线程数
+        uint64_t rejected_num;      // NO_PENDING模式下因线程全忙被拒绝的任务数
+        uint64_t expired_num;       // 开始执行时已过截止时间而被丢弃的任务数，见Options::drop_expired
+        uint64_t executed_num;      // 已执行完的任务数
+        uint64_t wait_time_us;      // 累计排队时间(us)
+        uint64_t exec_time_us;      // 累计执行时间(us)
+        uint64_t park_num;          // 空闲线程进入睡眠的次数，过高时可增大spin_num
+        // 排队时间和执行时间分布，第0桶为<1us，第i桶为[2^(i-1), 2^i)us，最后一桶包含更大值
+        uint64_t wait_hist[kLATENCY_BUCKET_NUM];
+        uint64_t exec_hist[kLATENCY_BUCKET_NUM];
+    };
+
     enum Mode {
         NO_PENDING = 0, // 当所有线程忙时，不再接受新的任务，因为线程为抢占运行，所有状态均为瞬态，存在误差
         PENDING,        // 当所有线程忙时，新增任务暂时被缓存起来
     };
 
+    // 任务优先级，数值越小越优先，可以使用其他非负值，见Options::priority_queue
+    enum Priority {
+        PRIORITY_HIGH = 0,
+        PRIORITY_NORMAL = 1,
+        PRIORITY_LOW = 2,
+    };
+
+    // 单个任务的调度属性，仅在Options::priority_queue为true时有效
+    struct TaskOptions
+    {
+        TaskOptions() : priority(PRIORITY_NORMAL), timeout_ms(-1) {}
+        int32_t priority;           // 优先级，见Priority
+        int32_t timeout_ms;         // 截止时间为提交后timeout_ms，<0为没有截止时间
+    };
+
+    // 线程池的配置
+    struct Options
+    {
+        Options() : thread_num(4), mode(PENDING), work_stealing(false), local_queue_size(1024),
+            global_queue_size(65536), numa_spread(false), stack_size(0), sched_policy(-1),
+            sched_priority(0), spin_num(256), yield_num(4), park_timeout_ms(-1),
+            max_thread_num(0), spawn_wait_ms(10), idle_timeout_ms(60000), priority_queue(false),
+            aging_ms(100), drop_expired(false) {}
+        int32_t thread_num;         // 线程个数，最大为256，弹性伸缩时为线程数下限
+        int32_t mode;               // 运行模式，见Mode
+        bool work_stealing;         // 是否使用工作窃取模式，小任务多且任务内会再提交任务时使用
+        uint32_t local_queue_size;  // 工作窃取模式下每个线程本地队列的容量，满时放入全局队列
+        uint32_t global_queue_size; // 工作窃取模式下全局无锁队列的容量，满时放入加锁的溢出队列
+        std::vector<int32_t> cpus;  // 可用的CPU，不按NUMA分布时第i个线程绑定cpus[i % cpus.size()]，
+                                    // 为空时不绑定
+        bool numa_spread;           // 线程轮流分布到各NUMA节点，绑定到节点内(且在cpus中)的CPU
+        size_t stack_size;          // 线程栈大小(字节)，0为系统默认
+        int32_t sched_policy;       // 线程调度策略，如SCHED_FIFO，<0为系统默认
+        int32_t sched_priority;     // 线程调度优先级，实时调度策略时有效
+        // 空闲线程先自旋，再让出CPU，最后睡眠，新任务提交时只唤醒一个睡眠的线程
+        uint32_t spin_num;          // 自旋检查次数上限，按是否等到任务自适应调整，单核时不自旋
+        uint32_t yield_num;         // 自旋后sched_yield的次数
+        int32_t park_timeout_ms;    // 睡眠超时(ms)，<0为直到有新任务
+        // 弹性伸缩，max_thread_num大于thread_num时生效
+        int32_t max_thread_num;     // 线程数上限，最大为256
+        int32_t spawn_wait_ms;      // 有任务排队超过此时间且没有空闲线程时，增加一个线程
+        int32_t idle_timeout_ms;    // 线程空闲超过此时间后退出，直到线程数为thread_num
+        // 优先级调度，所有任务放入一个按最晚开始时间排序的加锁队列，代替FIFO队列和工作窃取队列
+        //   优先级为p的任务最晚开始时间为提交时间+p*aging_ms，有截止时间时取两者中较早的，
+        //   因此低优先级任务最多被之后提交的高优先级任务推迟(优先级差*aging_ms)，不会饿死
+        bool priority_queue;
+        int32_t aging_ms;           // 相邻优先级之间相差的等待时间
+        bool drop_expired;          // 开始执行时已过截止时间的任务不再执行，其Future失效
+    };
+
     ThreadPool();
     ~ThreadPool();
 
@@ -58,6 +142,12 @@ public:
     /// @return 0: 成功 其他: 失败
     int Init(int32_t thread_num = 4, int32_t mode = PENDING);
 
+    /// @brief 按配置初始化线程池
+    ///
+    /// @param[in] options 线程池配置
+    /// @return 0: 成功 其他: 失败
+    int Init(const Options& options);
+
     /// @brief 向线程池中增加一个待执行的任务
     //         线程池中的线程有空闲时，就会争抢并且执行该任务
     //
@@ -74,12 +164,82 @@ public:
     /// @return 0: 成功 其他: 失败
     int AddTask(cxx::function<void()>& fun, int64_t task_id = -1);
 
-    /// @brief 获得线程池的运行状态（暂时还未实现）
+    /// @brief 向线程池中增加一个待执行的任务，优先由提交者所在NUMA节点上的线程执行
+    //
+    //  仅在工作窃取模式且线程按NUMA节点分布时有效，否则与AddTask相同
+    //  节点内的线程都忙时，其他节点的空闲线程仍会取走任务
+    ///
+    /// @param[in] fun 待执行任务函数指针
+    /// @param[in] task_id 待执行任务id，同AddTask
+    /// @return 0: 成功 其他: 失败
+    int AddLocalTask(cxx::function<void()>& fun, int64_t task_id = -1);
+
+    /// @brief 向线程池中增加一个指定优先级或截止时间的任务
+    //
+    //  仅在Options::priority_queue为true时按task_options调度，否则与AddTask相同
+    //  任务因已过截止时间被丢弃时，task_id不会写入完成队列
+    ///
+    /// @param[in] fun 待执行任务函数指针
+    /// @param[in] task_options 任务的优先级和截止时间
+    /// @param[in] task_id 待执行任务id，同AddTask
+    /// @return 0: 成功 其他: 失败
+    int AddTask(cxx::function<void()>& fun, const TaskOptions& task_options,
+        int64_t task_id = -1);
+
+    /// @brief 向线程池中增加一个待执行的任务，通过future等待任务完成并获取返回值
+    ///
+    /// @param[in] fun 待执行任务，返回值类型为R，可以为void
+    /// @param[out] future 任务的Future，仅在成功时设置
+    //  任务未执行就被丢弃时(如Terminate(false))，future失效，见Future
+    ///
+    /// @return 0: 成功 其他: 失败
+    template <typename R>
+    int AddTask(const typename FutureFunction<R, void>::Type& fun, Future<R>* future) {
+        Promise<R> promise;
+        cxx::function<void()> task = cxx::bind(&FutureRun<R>::Run, fun, promise);
+        int ret = AddTask(task);
+        if (ret == 0) {
+            *future = promise.GetFuture();
+        }
+        return ret;
+    }
+
+    /// @brief 向线程池中增加一个指定优先级或截止时间的任务，通过future等待任务完成并获取返回值
+    //  任务因已过截止时间被丢弃时，future失效
+    template <typename R>
+    int AddTask(const typename FutureFunction<R, void>::Type& fun, const TaskOptions& task_options,
+        Future<R>* future) {
+        Promise<R> promise;
+        cxx::function<void()> task = cxx::bind(&FutureRun<R>::Run, fun, promise);
+        int ret = AddTask(task, task_options);
+        if (ret == 0) {
+            *future = promise.GetFuture();
+        }
+        return ret;
+    }
+
+    /// @brief 实现Executor，可作为Future::Then的执行器
+    virtual int32_t Execute(const cxx::function<void()>& fun);
+
+    /// @brief 获得线程池的运行状态，无锁，可频繁调用
     ///
     /// @param[out] stat 线程池运行状态
     /// @return void
     void GetStatus(Stats* stat);
 
+    /// @brief 获得线程池的运行统计，汇总各线程的计数和延迟分布
+    ///
+    /// @param[out] snapshot 运行统计
+    /// @return void
+    void GetSnapshot(Snapshot* snapshot);
+
+    /// @brief 由延迟分布估算分位值
+    ///
+    /// @param[in] hist Snapshot中的wait_hist或exec_hist
+    /// @param[in] ratio 分位，如0.99
+    /// @return 分位值所在桶的上界(us)
+    static uint64_t GetPercentile(const uint64_t* hist, double ratio);
+
     /// @brief 停止接受新的任务，并终止掉线程池中所有线程的运行
     ///
     /// @param[in] waiting true:  会等待所有pending的task执行完才会结束
@@ -92,33 +252,141 @@ public:
 private:
     struct Task {
     public:
+        Task() : task_id(-1), enqueue_us(0), deadline_us(0), sched_us(0), sched_seq(0) {}
         cxx::function<void()> fun;
         int64_t task_id;
+        int64_t enqueue_us;     // 提交时间，用于统计排队时间
+        int64_t deadline_us;    // 截止时间，0为没有
+        int64_t sched_us;       // 最晚开始时间，优先级调度时按此排序
+        uint64_t sched_seq;     // 进入优先级队列的序号，sched_us相同时先进先出
     };
 
     class InnerThread : public Thread {
     public:
-        InnerThread(BlockingQueue<Task>* pending_queue,
-            BlockingQueue<int64_t>* finished_queue, BlockingQueue<int64_t>* working_queue);
+        InnerThread(ThreadPool* pool, uint32_t index);
 
         virtual void Run();
         void Terminate(bool waiting = true);
     private:
-        BlockingQueue<Task>* m_pending_queue;
-        BlockingQueue<int64_t>* m_finished_queue;
-        BlockingQueue<int64_t>* m_working_queue;
+        ThreadPool* m_pool;
+        uint32_t m_index;
         bool m_exit;
         bool m_waiting;
     };
 
+    // 每个线程的统计计数，只由所属线程写入，按缓存行对齐避免伪共享
+    struct WorkerCounter {
+        int32_t live;       // 该位置是否有运行中的线程，创建线程时也会写入
+        int32_t busy;
+        uint64_t park_num;
+        uint64_t expired_num;
+        uint64_t executed_num;
+        uint64_t wait_time_us;
+        uint64_t exec_time_us;
+        uint64_t wait_hist[kLATENCY_BUCKET_NUM];
+        uint64_t exec_hist[kLATENCY_BUCKET_NUM];
+    } __attribute__((aligned(PEBBLE_CACHELINE_SIZE)));
+
+    class StealingThread : public Thread {
+    public:
+        StealingThread(ThreadPool* pool, uint32_t index) : m_pool(pool), m_index(index) {}
+
+        virtual void Run() {
+            m_pool->StealingRun(m_index);
+        }
+    private:
+        ThreadPool* m_pool;
+        uint32_t m_index;
+    };
+
+    // 工作窃取模式下每个线程的本地队列
+    struct Worker {
+        explicit Worker(uint32_t queue_size) : deque(queue_size), seed(0), node(-1) {}
+        WorkStealingDeque<Task*> deque;
+        uint64_t seed;  // 随机选择窃取对象
+        int32_t node;   // 所在NUMA节点，-1为未绑定
+        char pad[PEBBLE_CACHELINE_SIZE];
+    };
+
+    int SubmitTask(cxx::function<void()>& fun, int64_t task_id, bool local,
+        const TaskOptions& task_options);
+    void PushPriorityTask(Task* task);
+    Task* PopPriorityTask();
+    void ClearPriorityTask();
+    static bool LaterTask(const Task* left, const Task* right);
+    bool HasPendingTask();
+    bool StartWorker(uint32_t index);
+    bool NeedGrow();
+    void TryGrow();
+    bool TryRetire(uint32_t index, int64_t* idle_since);
+    void InitPlacement(const Options& options, std::vector<Thread::Attr>* attrs);
+    int32_t CurrentNode();
+    void RunTask(uint32_t index, Task* task);
+    size_t WorkingThreadNum();
+    void StealingRun(uint32_t index);
+    void PushStealingTask(Task* task, bool local);
+    Task* GetStealingTask(uint32_t index);
+    bool StealTask(uint32_t index, int32_t node, Task** task);
+    bool HasStealingTask();
+    void WaitTask(uint32_t index, int32_t seq, uint32_t* spin_limit);
+    void WakeUpIdle();
+    void WakeUpAll();
+    void TerminateStealing(bool waiting);
+
     std::vector<InnerThread*> m_threads;
     BlockingQueue<Task> m_pending_queue;
     BlockingQueue<int64_t> m_finished_queue;
-    BlockingQueue<int64_t> m_working_queue;
+    WorkerCounter* m_counters;              // 每个线程一个
+    int32_t m_active_num;                   // 已提交未执行完的任务数，用于NO_PENDING模式的准入
+    char m_pad[PEBBLE_CACHELINE_SIZE];
+    uint64_t m_rejected_num;
+
+    // 线程分布
+    std::vector<std::vector<int32_t> > m_node_cpus; // 每个NUMA节点可用的CPU
+    std::vector<int32_t> m_cpu_node;                // CPU所在节点的下标，-1为不可用
+    std::vector<int32_t> m_worker_node;             // 线程所在节点的下标，-1为未绑定
     bool m_exit;
     bool m_initialized;
-    uint32_t m_thread_num;
+    uint32_t m_thread_num;                  // 线程位置数，弹性伸缩时为上限
     int32_t  m_mode;
+
+    // 工作窃取模式
+    bool m_work_stealing;
+    bool m_waiting;
+    std::vector<StealingThread*> m_stealing_threads;
+    std::vector<Worker*> m_workers;
+    MpmcRing<Task*>* m_inject_queue;        // 外部线程提交任务的全局队列
+    BlockingQueue<Task*> m_overflow_queue;  // 全局队列满时的溢出队列，保持任务数不受限
+    std::vector<MpmcRing<Task*>*> m_node_queues;  // 每个NUMA节点一个，AddLocalTask使用
+
+    // 空闲线程等待
+    uint32_t m_spin_num;
+    uint32_t m_yield_num;
+    int32_t m_park_timeout_ms;
+    char m_pad2[PEBBLE_CACHELINE_SIZE];
+    int32_t m_task_seq;                     // 每次提交任务加1，空闲线程在此睡眠
+    int32_t m_sleeper_num;                  // 睡眠的线程数，为0时提交任务不需要唤醒
+    char m_pad3[PEBBLE_CACHELINE_SIZE];
+
+    // 弹性伸缩，线程退出后其位置留给之后新增的线程
+    bool m_elastic;
+    uint32_t m_min_thread_num;
+    int64_t m_spawn_wait_us;
+    int64_t m_idle_timeout_us;
+    std::vector<Thread::Attr> m_attrs;      // 每个位置的线程属性
+    Mutex m_resize_mutex;                   // 新增线程与Terminate互斥
+    int32_t m_live_num;                     // 当前线程数
+    int64_t m_last_dequeue_us;              // 最近取出任务的时间，精度1ms，用于判断队列是否停滞
+    uint64_t m_spawn_num;
+    uint64_t m_retire_num;
+
+    // 优先级调度
+    bool m_priority_queue;
+    bool m_drop_expired;
+    int64_t m_aging_us;
+    Mutex m_priority_mutex;
+    std::vector<Task*> m_priority_heap;     // 按sched_us、sched_seq排序的小顶堆
+    uint64_t m_priority_seq;
 };
 
 } // namespace pebble
@@ -195,11 +195,44 @@ int32_t FdTimer::Update() {
 
 SequenceTimer::SequenceTimer() {
     m_in_callback = false;
+    m_cur_timer = NULL;
+    m_cur_timer_stopped = false;
     m_timer_seqid   = 0;
+    m_resolution_ms = 0;
+    m_next_update_time = 0;
     m_last_error[0] = 0;
 }
 
 SequenceTimer::~SequenceTimer() {
+    cxx::unordered_map<int64_t, TimerItem*>::iterator it = m_timers.begin();
+    for (; it != m_timers.end(); ++it) {
+        delete it->second;
+    }
+    m_timers.clear();
+}
+
+DbListItem* SequenceTimer::GetTimerList(uint32_t timeout_ms) {
+	DbListItem& head = m_timer_lists[timeout_ms];
+	if (head._next == NULL || head._prev == NULL) {
+		db_list_init(&head);
+		m_timer_list_heads.push_back(&head);
+	}
+	return &head;
+}
+
+uint32_t SequenceTimer::AlignTimeout(uint32_t timeout_ms) const {
+    if (m_resolution_ms <= 1) {
+        return timeout_ms;
+    }
+    uint64_t aligned = (static_cast<uint64_t>(timeout_ms) + m_resolution_ms - 1)
+        / m_resolution_ms * m_resolution_ms;
+    return aligned > UINT32_MAX ? timeout_ms : static_cast<uint32_t>(aligned);
+}
+
+int32_t SequenceTimer::SetResolution(uint32_t resolution_ms) {
+    m_resolution_ms = resolution_ms;
+    m_next_update_time = 0;
+    return 0;
 }
 
 int64_t SequenceTimer::StartTimer(uint32_t timeout_ms, const TimeoutCallback& cb) {
@@ -207,6 +240,7 @@ int64_t SequenceTimer::StartTimer(uint32_t timeout_ms, const TimeoutCallback& cb
         _LOG_LAST_ERROR("param is invalid: timeout_ms = %u, cb = %d", timeout_ms, (cb ? true : false));
         return kTIMER_INVALID_PARAM;
     }
+    timeout_ms = AlignTimeout(timeout_ms);
 
     TimerItem* item = new TimerItem;
     item->id         = m_timer_seqid;
@@ -214,11 +248,7 @@ int64_t SequenceTimer::StartTimer(uint32_t timeout_ms, const TimeoutCallback& cb
 	item->start_time = TimeUtility::GetCurrentMS();
     item->cb         = cb;
 
-	DbListItem& head = m_timer_lists[timeout_ms];
-	if (head._next == NULL || head._prev == NULL) {
-		db_list_init(&head);
-	}
-	db_list_add_tail(&head, &item->list_item);
+	db_list_add_tail(GetTimerList(timeout_ms), &item->list_item);
 
     m_timers[m_timer_seqid] = item;
 
@@ -226,11 +256,6 @@ int64_t SequenceTimer::StartTimer(uint32_t timeout_ms, const TimeoutCallback& cb
 }
 
 int32_t SequenceTimer::StopTimer(int64_t timer_id) {
-    if (m_in_callback) {
-        _LOG_LAST_ERROR("timer in callback, can't stop");
-        return kTIMER_IN_CALLBACK;
-    }
-
     cxx::unordered_map<int64_t, TimerItem*>::iterator it = m_timers.find(timer_id);
     if (m_timers.end() == it) {
         _LOG_LAST_ERROR("timer id %ld not exist", timer_id);
@@ -239,19 +264,20 @@ int32_t SequenceTimer::StopTimer(int64_t timer_id) {
 
 	TimerItem* timer_item = it->second;
 	db_list_del(&timer_item->list_item);
-	delete timer_item;
-
     m_timers.erase(it);
 
+    // 回调执行中不能释放自身，由Update在回调返回后释放
+    if (m_in_callback && timer_item == m_cur_timer) {
+        m_cur_timer_stopped = true;
+        return 0;
+    }
+
+	delete timer_item;
+
     return 0;
 }
 
 int32_t SequenceTimer::ReStartTimer(int64_t timer_id) {
-     if (m_in_callback) {
-        _LOG_LAST_ERROR("timer in callback, can't restart");
-        return kTIMER_IN_CALLBACK;
-    }
-
 	cxx::unordered_map<int64_t, TimerItem*>::iterator it = m_timers.find(timer_id);
     if (m_timers.end() == it) {
         _LOG_LAST_ERROR("timer id %ld not exist", timer_id);
@@ -260,7 +286,7 @@ int32_t SequenceTimer::ReStartTimer(int64_t timer_id) {
 
     TimerItem* timer_item = it->second;
 	timer_item->start_time = TimeUtility::GetCurrentMS();
-	
+
 	DbListItem& head = m_timer_lists[timer_item->timeout_ms];
 	assert(head._next != NULL && head._prev != NULL);
 	db_list_del(&timer_item->list_item);
@@ -273,37 +299,54 @@ int32_t SequenceTimer::Update() {
     int32_t num = 0;
     int64_t now = TimeUtility::GetCurrentMS();
     int32_t ret = 0;
+
+    // 开启合并后每个精度窗口只处理一次，窗口内到期的定时器在同一轮中超时
+    if (m_resolution_ms > 1) {
+        if (now < m_next_update_time) {
+            return 0;
+        }
+        m_next_update_time = (now / m_resolution_ms + 1) * m_resolution_ms;
+    }
+
     m_in_callback = true;
 
-    cxx::unordered_map<uint32_t, DbListItem>::iterator it = m_timer_lists.begin();
-    for (; it != m_timer_lists.end(); it++) {
-		DbListItem& head = it->second;
-		DbListItem* item = head._next;
-		while (item != &head) {
+    // 回调中可能新增超时列表，按下标遍历，新增的列表追加在尾部
+    for (size_t i = 0; i < m_timer_list_heads.size(); i++) {
+		DbListItem* head = m_timer_list_heads[i];
+		DbListItem* item = head->_next;
+		while (item != head) {
 			TimerItem* timer_item = container(TimerItem, list_item, item);
 			assert(timer_item);
 			if (timer_item->start_time + timer_item->timeout_ms > now) {
 				break;
 			}
 
+			m_cur_timer = timer_item;
+			m_cur_timer_stopped = false;
 			ret = timer_item->cb(timer_item->id);
-            //用户在超时回调中可能stop/restart定时器，这里需要特殊处理
-            
+			m_cur_timer = NULL;
+
+			// 回调中stop/restart其他定时器时直接修改了链表，每轮都从链表头重新取
+			// 自身在回调中被stop，已从链表和m_timers中移除，忽略返回值
+			if (m_cur_timer_stopped) {
+				delete timer_item;
 			// 返回 <0 删除定时器，=0 继续，>0按新的超时时间重启定时器
-	        if (ret < 0) {
+			} else if (ret < 0) {
 				db_list_del(item);
 	            m_timers.erase(timer_item->id);
-				delete item;
+				delete timer_item;
 	        } else {
-	            if (ret > 0) {
-	                timer_item->timeout_ms = ret;
+				DbListItem* new_head = head;
+	            if (ret > 0 && AlignTimeout(ret) != timer_item->timeout_ms) {
+	                timer_item->timeout_ms = AlignTimeout(ret);
+	                new_head = GetTimerList(timer_item->timeout_ms);
 	            }
 				timer_item->start_time = now;
 				db_list_del(item);
-				db_list_add_tail(&head, item);
+				db_list_add_tail(new_head, item);
 	        }
 
-			item = head._next;
+			item = head->_next;
 			num++;
         }
     }
@@ -14,6 +14,8 @@
 #ifndef _PEBBLE_COMMON_TIMER_H_
 #define _PEBBLE_COMMON_TIMER_H_
 
+#include <vector>
+
 #include "common/db_list.h"
 #include "common/error.h"
 #include "common/platform.h"
@@ -29,8 +31,8 @@ typedef enum {
     kTIMER_NUM_OUT_OF_RANGE = kTIMER_ERROR_BASE - 2, // 定时器数量超出限制范围
     kTIMER_UNEXISTED        = kTIMER_ERROR_BASE - 3, // 定时器不存在
     kSYSTEM_ERROR           = kTIMER_ERROR_BASE - 4, // 系统错误
-    kTIMER_IN_CALLBACK      = kTIMER_ERROR_BASE - 5, // 定时器超时回调处理中，stop/restart操作失败，请使用返回值控制
-    //TODO:这样做不太好，待改进
+    kTIMER_IN_CALLBACK      = kTIMER_ERROR_BASE - 5, // 已废弃，SequenceTimer支持在超时回调中stop/restart
+    kTIMER_UNSUPPORTED      = kTIMER_ERROR_BASE - 6, // 定时器实现不支持该操作
 } TimerErrorCode;
 
 class TimerErrorStringRegister {
@@ -41,6 +43,7 @@ public:
         SetErrorString(kTIMER_UNEXISTED, "timer unexist");
         SetErrorString(kSYSTEM_ERROR, "system error");
         SetErrorString(kTIMER_IN_CALLBACK, "timer in timeout callback, can't be stop/restart");
+        SetErrorString(kTIMER_UNSUPPORTED, "operation unsupported by this timer");
     }
 };
 
@@ -79,12 +82,25 @@ public:
     /// @return <0 失败 @see TimerErrorCode
     virtual int32_t StopTimer(int64_t timer_id) = 0;
 
+    /// @brief 重启定时器，从当前时间开始重新计时
+    /// @param timer_id StartTimer时返回的ID
+    /// @return 0 成功
+    /// @return <0 失败 @see TimerErrorCode
 	virtual int32_t ReStartTimer(int64_t timer_id) = 0;
 
     /// @brief 定时器驱动
     /// @return 超时定时器数，为0时表示本轮无定时器超时
     virtual int32_t Update() = 0;
 
+    /// @brief 设置定时器精度，超时时间落在同一精度窗口内的定时器在同一次Update中批量超时
+    /// @param resolution_ms 精度(ms)，0表示不合并，按毫秒精度超时
+    /// @return 0 成功
+    /// @return <0 失败 @see TimerErrorCode
+    /// @note 超时时间向上取整为resolution_ms的整数倍，且每个精度窗口只处理一次超时，
+    ///   因此定时器最多会晚将近2*resolution_ms超时(另加Update的调用间隔)，
+    ///   适合大量超时时间相近、对精度不敏感的定时器，如会话保活
+    virtual int32_t SetResolution(uint32_t /* resolution_ms */) { return kTIMER_UNSUPPORTED; }
+
     /// @brief 返回最后一次的错误信息描述
     virtual const char* GetLastError() const { return NULL; }
 
@@ -151,6 +167,7 @@ private:
 /// @brief 顺序定时器，按超时时间组织，每个超时时间维护一个列表，先加入先超时
 ///     适合一组离散的单次超时处理，如RPC的请求、协程的超时等
 ///     复杂度:start O(1gn)，timeout O(1)，stop O(1gn)
+/// @note 超时回调中可以stop/restart任意定时器（包括自身），自身被stop时忽略回调返回值
 class SequenceTimer : public Timer {
 public:
     SequenceTimer();
@@ -168,6 +185,10 @@ public:
     /// @see Timer::Update
     virtual int32_t Update();
 
+    /// @see Timer::SetResolution
+    /// @note 超时时间向上取整到精度的整数倍，减少超时列表数，Update每个精度窗口最多处理一次
+    virtual int32_t SetResolution(uint32_t resolution_ms);
+
     /// @see Timer::LastErrorStr
     virtual const char* GetLastError() const {
         return m_last_error;
@@ -194,11 +215,22 @@ private:
         TimeoutCallback cb;
     };
 
+private:
+    DbListItem* GetTimerList(uint32_t timeout_ms);
+
+    uint32_t AlignTimeout(uint32_t timeout_ms) const;
+
 private:
     bool m_in_callback;
+    TimerItem* m_cur_timer;             // 正在执行超时回调的定时器
+    bool m_cur_timer_stopped;           // 正在执行回调的定时器在回调中被stop，回调返回后再释放
     int64_t m_timer_seqid;
+    uint32_t m_resolution_ms;           // 定时器精度，0表示不合并
+    int64_t m_next_update_time;         // 开启合并后，下一次需要处理超时的时间
     // map<timeout_ms, dblist head >
     cxx::unordered_map<uint32_t, DbListItem> m_timer_lists;
+    // 按下标遍历，回调中新增超时列表不会使Update的遍历失效
+    std::vector<DbListItem*> m_timer_list_heads;
     // map<timer_seqid, TimerItem>
     cxx::unordered_map<int64_t, TimerItem*> m_timers;
     char m_last_error[256];
@@ -0,0 +1,292 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#include <string.h>
+#include <algorithm>
+
+#include "common/log.h"
+#include "common/timer_service.h"
+
+
+namespace pebble {
+
+// 最近一次查找的服务(按实例编号)及分片，避免每次操作都遍历分片
+static __thread uint64_t t_cached_generation = 0;
+static __thread int32_t t_cached_shard = -1;
+
+// 实例编号从1开始，0表示线程缓存为空
+static uint64_t g_next_generation = 0;
+
+TimerService::TimerService() {
+    memset(m_shards, 0, sizeof(m_shards));
+    m_shard_num = 0;
+    m_generation = __atomic_add_fetch(&g_next_generation, 1, __ATOMIC_RELAXED);
+}
+
+TimerService::~TimerService() {
+    for (int32_t i = 0; i < kMAX_SHARD_NUM; i++) {
+        delete m_shards[i];
+        m_shards[i] = NULL;
+    }
+    if (t_cached_generation == m_generation) {
+        t_cached_generation = 0;
+        t_cached_shard = -1;
+    }
+}
+
+int32_t TimerService::RegisterThread() {
+    int32_t local = LocalShard();
+    if (local >= 0) {
+        return local;
+    }
+
+    int32_t index = __atomic_fetch_add(&m_shard_num, 1, __ATOMIC_ACQ_REL);
+    if (index >= kMAX_SHARD_NUM) {
+        __atomic_fetch_sub(&m_shard_num, 1, __ATOMIC_ACQ_REL);
+        return kTIMER_NUM_OUT_OF_RANGE;
+    }
+
+    Shard* shard = new Shard;
+    shard->owner = pthread_self();
+    __atomic_store_n(&m_shards[index], shard, __ATOMIC_RELEASE);
+
+    t_cached_generation = m_generation;
+    t_cached_shard = index;
+    return index;
+}
+
+int32_t TimerService::UnregisterThread() {
+    int32_t local = LocalShard();
+    if (local < 0) {
+        return kTIMER_INVALID_PARAM;
+    }
+    Shard* shard = m_shards[local];
+    __atomic_store_n(&shard->registered, 0, __ATOMIC_RELEASE);
+    // 丢弃已投递的操作，之后的投递会被拒绝
+    TimerOp op;
+    while (shard->inbox.TryPop(&op)) {
+    }
+    t_cached_generation = 0;
+    t_cached_shard = -1;
+    return 0;
+}
+
+int32_t TimerService::LocalShard() const {
+    if (t_cached_generation == m_generation) {
+        return t_cached_shard;
+    }
+
+    // 其他线程注册时分片号已分配但分片可能尚未发布，跳过空位继续查找
+    pthread_t self = pthread_self();
+    int32_t shard_num = std::min(__atomic_load_n(&m_shard_num, __ATOMIC_ACQUIRE),
+        static_cast<int32_t>(kMAX_SHARD_NUM));
+    for (int32_t i = 0; i < shard_num; i++) {
+        Shard* shard = __atomic_load_n(&m_shards[i], __ATOMIC_ACQUIRE);
+        if (NULL == shard) {
+            continue;
+        }
+        if (__atomic_load_n(&shard->registered, __ATOMIC_ACQUIRE)
+            && pthread_equal(shard->owner, self)) {
+            t_cached_generation = m_generation;
+            t_cached_shard = i;
+            return i;
+        }
+    }
+    return -1;
+}
+
+int64_t TimerService::StartTimer(uint32_t timeout_ms, const TimeoutCallback& cb) {
+    int32_t local = LocalShard();
+    if (local < 0) {
+        return kTIMER_INVALID_PARAM;
+    }
+    return StartTimer(local, timeout_ms, cb);
+}
+
+int64_t TimerService::StartTimer(int32_t shard_index, uint32_t timeout_ms, const TimeoutCallback& cb) {
+    // 与SequenceTimer::StartTimer的检查一致，投递的start在分片线程中不会再因参数失败
+    if (shard_index < 0 || shard_index >= kMAX_SHARD_NUM || !cb || 0 == timeout_ms) {
+        return kTIMER_INVALID_PARAM;
+    }
+    Shard* shard = __atomic_load_n(&m_shards[shard_index], __ATOMIC_ACQUIRE);
+    if (NULL == shard) {
+        return kTIMER_INVALID_PARAM;
+    }
+
+    int64_t seqid = __atomic_fetch_add(&shard->seqid, 1, __ATOMIC_RELAXED);
+    int64_t id = (seqid << kSHARD_BITS) | shard_index;
+
+    if (shard_index == LocalShard()) {
+        return DoStart(shard, id, timeout_ms, cb);
+    }
+    // 已注销的分片不再有线程处理投递的操作
+    if (!__atomic_load_n(&shard->registered, __ATOMIC_ACQUIRE)) {
+        return kTIMER_INVALID_PARAM;
+    }
+
+    TimerOp op;
+    op.type = kOP_START;
+    op.id = id;
+    op.timeout_ms = timeout_ms;
+    op.cb = cb;
+    shard->inbox.Push(op);
+    return id;
+}
+
+int32_t TimerService::StopTimer(int64_t timer_id) {
+    if (timer_id < 0) {
+        return kTIMER_UNEXISTED;
+    }
+    int32_t shard_index = static_cast<int32_t>(timer_id & (kMAX_SHARD_NUM - 1));
+    Shard* shard = __atomic_load_n(&m_shards[shard_index], __ATOMIC_ACQUIRE);
+    if (NULL == shard) {
+        return kTIMER_UNEXISTED;
+    }
+
+    if (shard_index == LocalShard()) {
+        // 先处理已投递的start，避免其在stop之后才生效
+        DrainInbox(shard);
+        return DoStop(shard, timer_id);
+    }
+    if (!__atomic_load_n(&shard->registered, __ATOMIC_ACQUIRE)) {
+        return kTIMER_INVALID_PARAM;
+    }
+
+    TimerOp op;
+    op.type = kOP_STOP;
+    op.id = timer_id;
+    shard->inbox.Push(op);
+    return 0;
+}
+
+int32_t TimerService::ReStartTimer(int64_t timer_id) {
+    if (timer_id < 0) {
+        return kTIMER_UNEXISTED;
+    }
+    int32_t shard_index = static_cast<int32_t>(timer_id & (kMAX_SHARD_NUM - 1));
+    Shard* shard = __atomic_load_n(&m_shards[shard_index], __ATOMIC_ACQUIRE);
+    if (NULL == shard) {
+        return kTIMER_UNEXISTED;
+    }
+
+    if (shard_index == LocalShard()) {
+        DrainInbox(shard);
+        return DoReStart(shard, timer_id);
+    }
+    if (!__atomic_load_n(&shard->registered, __ATOMIC_ACQUIRE)) {
+        return kTIMER_INVALID_PARAM;
+    }
+
+    TimerOp op;
+    op.type = kOP_RESTART;
+    op.id = timer_id;
+    shard->inbox.Push(op);
+    return 0;
+}
+
+int32_t TimerService::Update() {
+    int32_t local = LocalShard();
+    if (local < 0) {
+        return 0;
+    }
+    Shard* shard = m_shards[local];
+    DrainInbox(shard);
+
+    return shard->timer.Update();
+}
+
+int32_t TimerService::SetResolution(uint32_t resolution_ms) {
+    int32_t local = LocalShard();
+    if (local < 0) {
+        return kTIMER_INVALID_PARAM;
+    }
+    return m_shards[local]->timer.SetResolution(resolution_ms);
+}
+
+const char* TimerService::GetLastError() const {
+    int32_t local = LocalShard();
+    if (local < 0) {
+        return "current thread not registered";
+    }
+    return m_shards[local]->timer.GetLastError();
+}
+
+int64_t TimerService::GetTimerNum() {
+    int32_t local = LocalShard();
+    if (local < 0) {
+        return 0;
+    }
+    return m_shards[local]->timer.GetTimerNum();
+}
+
+void TimerService::DrainInbox(Shard* shard) {
+    TimerOp op;
+    while (shard->inbox.TryPop(&op)) {
+        switch (op.type) {
+            case kOP_START:
+                // 参数已在投递前检查，失败时ID已返回给调用者，只能记录日志
+                if (DoStart(shard, op.id, op.timeout_ms, op.cb) < 0) {
+                    PLOG_ERROR("start posted timer %ld failed(%s)", op.id,
+                        shard->timer.GetLastError());
+                }
+                break;
+            case kOP_STOP:
+                DoStop(shard, op.id);
+                break;
+            case kOP_RESTART:
+                DoReStart(shard, op.id);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+int64_t TimerService::DoStart(Shard* shard, int64_t id, uint32_t timeout_ms,
+    const TimeoutCallback& cb) {
+    int64_t local_id = shard->timer.StartTimer(timeout_ms,
+        cxx::bind(&TimerService::OnTimeout, this, shard, id, cb));
+    if (local_id < 0) {
+        return local_id;
+    }
+    shard->timer_ids[id] = local_id;
+    return id;
+}
+
+int32_t TimerService::DoStop(Shard* shard, int64_t id) {
+    cxx::unordered_map<int64_t, int64_t>::iterator it = shard->timer_ids.find(id);
+    if (shard->timer_ids.end() == it) {
+        return kTIMER_UNEXISTED;
+    }
+    int64_t local_id = it->second;
+    shard->timer_ids.erase(it);
+    return shard->timer.StopTimer(local_id);
+}
+
+int32_t TimerService::DoReStart(Shard* shard, int64_t id) {
+    cxx::unordered_map<int64_t, int64_t>::iterator it = shard->timer_ids.find(id);
+    if (shard->timer_ids.end() == it) {
+        return kTIMER_UNEXISTED;
+    }
+    return shard->timer.ReStartTimer(it->second);
+}
+
+int32_t TimerService::OnTimeout(Shard* shard, int64_t id, const TimeoutCallback& cb) {
+    int32_t ret = cb(id);
+    if (ret < 0) {
+        shard->timer_ids.erase(id);
+    }
+    return ret;
+}
+
+}  // namespace pebble
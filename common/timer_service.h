@@ -0,0 +1,135 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+#ifndef _PEBBLE_COMMON_TIMER_SERVICE_H_
+#define _PEBBLE_COMMON_TIMER_SERVICE_H_
+
+#include <pthread.h>
+#include <vector>
+
+#include "common/mpsc_queue.h"
+#include "common/timer.h"
+
+
+namespace pebble {
+
+/// @brief 多线程定时器服务，每个线程一个分片(SequenceTimer)
+///   1、线程调用RegisterThread注册分片，之后在本线程循环调用Update驱动定时器
+///   2、本线程的start/stop/restart直接操作本分片，无锁
+///   3、其他线程的start/stop/restart通过分片的无锁MPSC队列投递，由分片线程在Update中处理
+///   4、超时回调总是在分片所属的线程中执行
+/// @note 跨线程的stop/restart是异步的，返回0仅表示已投递，定时器不存在时被忽略
+///   分片线程stop/restart前会先处理已投递的操作，跨线程start返回的ID可以立即在分片线程中使用
+class TimerService : public Timer {
+public:
+    /// @brief 定时器ID的低kSHARD_BITS位为分片号
+    static const int32_t kSHARD_BITS = 8;
+    static const int32_t kMAX_SHARD_NUM = 1 << kSHARD_BITS;
+
+    TimerService();
+    virtual ~TimerService();
+
+    /// @brief 将当前线程注册为一个分片，每个线程只需注册一次
+    /// @return >=0 分片号
+    /// @return <0 失败 @see TimerErrorCode
+    /// @note 所有分片须在跨线程使用前注册完成
+    int32_t RegisterThread();
+
+    /// @brief 注销当前线程的分片，线程退出前须调用，避免线程ID被复用后新线程误用该分片
+    /// @return 0 成功
+    /// @return <0 失败 @see TimerErrorCode
+    /// @note 注销后分片上的定时器不再被驱动，分片号不再复用；已投递的操作被丢弃，
+    ///   之后向该分片的跨线程start/stop/restart返回kTIMER_INVALID_PARAM
+    int32_t UnregisterThread();
+
+    /// @brief 在当前线程的分片上启动定时器，当前线程须已注册
+    /// @see Timer::StartTimer
+    virtual int64_t StartTimer(uint32_t timeout_ms, const TimeoutCallback& cb);
+
+    /// @brief 在指定分片上启动定时器，可在任意线程调用，回调在分片所属线程执行
+    /// @param shard RegisterThread返回的分片号
+    /// @see Timer::StartTimer
+    /// @note 跨线程时参数在投递前同步检查，失败直接返回错误码；返回ID后分片线程中的启动
+    ///   不会再因参数失败，万一失败则以PLOG_ERROR记录并丢弃，定时器不会触发
+    int64_t StartTimer(int32_t shard, uint32_t timeout_ms, const TimeoutCallback& cb);
+
+    /// @brief 停止定时器，可在任意线程调用
+    /// @see Timer::StopTimer
+    virtual int32_t StopTimer(int64_t timer_id);
+
+    /// @brief 重启定时器，可在任意线程调用
+    /// @see Timer::ReStartTimer
+    virtual int32_t ReStartTimer(int64_t timer_id);
+
+    /// @brief 驱动当前线程的分片，处理其他线程投递的操作并执行超时回调
+    /// @see Timer::Update
+    virtual int32_t Update();
+
+    /// @brief 设置当前线程分片的定时器精度
+    /// @see Timer::SetResolution
+    virtual int32_t SetResolution(uint32_t resolution_ms);
+
+    /// @brief 返回当前线程分片最后一次的错误信息描述
+    virtual const char* GetLastError() const;
+
+    /// @brief 获取当前线程分片的定时器数目
+    virtual int64_t GetTimerNum();
+
+private:
+    enum OpType {
+        kOP_START = 0,
+        kOP_STOP,
+        kOP_RESTART,
+    };
+
+    struct TimerOp {
+        TimerOp() : type(kOP_START), id(-1), timeout_ms(0) {}
+        int32_t type;
+        int64_t id;
+        uint32_t timeout_ms;
+        TimeoutCallback cb;
+    };
+
+    struct Shard {
+        Shard() : registered(1), seqid(0) {}
+
+        pthread_t owner;
+        int32_t registered;                             // owner是否有效，注销后为0
+        int64_t seqid;                                  // 原子递增，用于分配定时器ID
+        SequenceTimer timer;
+        MpscQueue<TimerOp> inbox;                       // 其他线程投递的操作
+        cxx::unordered_map<int64_t, int64_t> timer_ids; // map<服务定时器ID, 分片内定时器ID>
+    };
+
+    int32_t LocalShard() const;
+
+    /// @brief 按投递顺序处理分片收到的操作，只能在分片所属线程调用
+    void DrainInbox(Shard* shard);
+
+    int64_t DoStart(Shard* shard, int64_t id, uint32_t timeout_ms, const TimeoutCallback& cb);
+
+    int32_t DoStop(Shard* shard, int64_t id);
+
+    int32_t DoReStart(Shard* shard, int64_t id);
+
+    int32_t OnTimeout(Shard* shard, int64_t id, const TimeoutCallback& cb);
+
+private:
+    Shard* m_shards[kMAX_SHARD_NUM];
+    int32_t m_shard_num;
+    uint64_t m_generation;  // 实例的唯一编号，线程缓存按此匹配，不受对象地址复用影响
+};
+
+}  // namespace pebble
+
+#endif  // _PEBBLE_COMMON_TIMER_SERVICE_H_
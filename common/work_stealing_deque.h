@@ -0,0 +1,146 @@
+/*
+ * Tencent is pleased to support the open source community by making Pebble available.
+ * Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+ * Licensed under the MIT License (the "License"); you may not use this file except in compliance
+ * with the License. You may obtain a copy of the License at
+ * http://opensource.org/licenses/MIT
+ * Unless required by applicable law or agreed to in writing, software distributed under the License
+ * is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing permissions and limitations under
+ * the License.
+ *
+ */
+
+
+#ifndef _PEBBLE_COMMON_WORK_STEALING_DEQUE_H_
+#define _PEBBLE_COMMON_WORK_STEALING_DEQUE_H_
+
+#include <stdint.h>
+#include <cstddef>
+
+#include "common/platform.h"
+
+namespace pebble {
+
+
+/// @brief 无锁工作窃取双端队列(Chase-Lev)，有界
+///   Push/Pop只能在队列的所有者线程调用，在底部后进先出；Steal可在任意线程调用，从顶部先进先出
+/// @note 元素通过原子读写访问，T须为指针或整数等可原子读写的类型
+template <typename T>
+class WorkStealingDeque
+{
+public:
+    typedef T ValueType;
+
+    /// @param capacity 容量，向上取整为2的幂
+    explicit WorkStealingDeque(uint32_t capacity = 4096) : m_top(0), m_bottom(0)
+    {
+        uint32_t size = 2;
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+        m_mask = size - 1;
+        m_buffer = new T[size];
+    }
+
+    ~WorkStealingDeque()
+    {
+        delete [] m_buffer;
+    }
+
+    /// @brief push element in to bottom of deque, owner thread only
+    /// @param value to be pushed
+    /// @note if deque is full, return false
+    bool Push(const T& value)
+    {
+        int64_t bottom = __atomic_load_n(&m_bottom, __ATOMIC_RELAXED);
+        int64_t top = __atomic_load_n(&m_top, __ATOMIC_ACQUIRE);
+        if (bottom - top > static_cast<int64_t>(m_mask))
+        {
+            return false;
+        }
+        __atomic_store_n(&m_buffer[bottom & m_mask], value, __ATOMIC_RELAXED);
+        __atomic_store_n(&m_bottom, bottom + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    /// @brief pop element from bottom of deque, owner thread only
+    /// @param value to hold the result
+    /// @note if deque is empty or the last element is stolen, return false
+    bool Pop(T* value)
+    {
+        int64_t bottom = __atomic_load_n(&m_bottom, __ATOMIC_RELAXED) - 1;
+        __atomic_store_n(&m_bottom, bottom, __ATOMIC_RELAXED);
+        // 先声明要取bottom，再读top，与Steal的先读top再读bottom形成全序
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        int64_t top = __atomic_load_n(&m_top, __ATOMIC_RELAXED);
+        if (top > bottom)
+        {
+            __atomic_store_n(&m_bottom, bottom + 1, __ATOMIC_RELAXED);
+            return false;
+        }
+
+        *value = __atomic_load_n(&m_buffer[bottom & m_mask], __ATOMIC_RELAXED);
+        if (top == bottom)
+        {
+            // 只剩最后一个元素，与窃取者竞争
+            bool won = __atomic_compare_exchange_n(&m_top, &top, top + 1, false,
+                __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+            __atomic_store_n(&m_bottom, bottom + 1, __ATOMIC_RELAXED);
+            return won;
+        }
+        return true;
+    }
+
+    /// @brief steal element from top of deque, any thread
+    /// @param value to hold the result
+    /// @note if deque is empty or lost the race to other thread, return false
+    bool Steal(T* value)
+    {
+        int64_t top = __atomic_load_n(&m_top, __ATOMIC_ACQUIRE);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        int64_t bottom = __atomic_load_n(&m_bottom, __ATOMIC_ACQUIRE);
+        if (top >= bottom)
+        {
+            return false;
+        }
+
+        T result = __atomic_load_n(&m_buffer[top & m_mask], __ATOMIC_RELAXED);
+        if (!__atomic_compare_exchange_n(&m_top, &top, top + 1, false,
+            __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        {
+            return false;
+        }
+        *value = result;
+        return true;
+    }
+
+    /// @brief approximate number of elements, any thread
+    size_t Size() const
+    {
+        int64_t bottom = __atomic_load_n(&m_bottom, __ATOMIC_ACQUIRE);
+        int64_t top = __atomic_load_n(&m_top, __ATOMIC_ACQUIRE);
+        return bottom > top ? static_cast<size_t>(bottom - top) : 0;
+    }
+
+    bool IsEmpty() const
+    {
+        return Size() == 0;
+    }
+
+private:
+    WorkStealingDeque(const WorkStealingDeque&);
+    WorkStealingDeque& operator=(const WorkStealingDeque&);
+
+    int64_t m_top;      ///< 窃取端
+    char m_pad1[PEBBLE_CACHELINE_SIZE - sizeof(int64_t)];
+    int64_t m_bottom;   ///< 所有者端
+    char m_pad2[PEBBLE_CACHELINE_SIZE - sizeof(int64_t)];
+    T* m_buffer;
+    uint32_t m_mask;
+};
+
+} // namespace pebble
+
+#endif // _PEBBLE_COMMON_WORK_STEALING_DEQUE_H_